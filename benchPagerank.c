@@ -0,0 +1,425 @@
+// benchPagerank.c
+//
+// This program benchmarks the phases of `pagerank` on one or more
+// collections, typically produced by `generateCollection`. A collection
+// directory is benchmarked in these phases:
+//
+//    parse      readCollection
+//    build      buildGraph
+//    iterate    one rank kernel pass over every page
+//    converge   calculatePageRank until convergence
+//    write      writePageRankToFile
+//
+// A binary edge file (`generateCollection -b`) has no page limit and is
+// benchmarked as `pagerank --edge-file` runs it:
+//
+//    load       opening, checking and mapping the edge file
+//    converge   the out-of-core iteration until convergence
+//
+// Every phase is repeated and reported as one JSON object per line, with
+// latency percentiles and page throughput, plus edge throughput for every
+// phase that streams the edges. The peak RSS is that of the whole benchmark
+// process so far, not of the phase, so it never goes down from one phase to
+// the next. Results of two commits can be compared with
+// `-c old.jsonl new.jsonl`. `-D` runs the converge phase with deterministic
+// reductions. pagerankList.txt is written to a temporary directory, never
+// into the dataset.
+//
+#define PAGERANK_NO_MAIN
+#include "pagerank.c"
+
+#define MAX_REPETITIONS 1000
+
+typedef struct {
+    const char *dataset;
+    const char *phase;
+    int N;
+    long edges;
+    double times[MAX_REPETITIONS];
+    int repetitions;
+    double workPerRun;      // edges processed by one run of the phase, 0 if none
+} BenchResult;
+
+// Function prototypes
+void benchUsage(const char *program);
+int compareDoubles(const void *a, const void *b);
+double percentile(const double sorted[], int count, double q);
+void reportResult(BenchResult *result, FILE *output);
+void benchmarkDataset(const char *dataset, int repetitions, const RankOptions *options,
+                      double d, double diffPR, int maxIterations, int scratch, FILE *output);
+double phaseSeconds(FILE *telemetry, const char *phase);
+void benchmarkEdgeFile(const char *dataset, int repetitions, double d, double diffPR,
+                       int maxIterations, int scratch, FILE *output);
+int compareResults(const char *oldPath, const char *newPath);
+
+int main(int argc, char **argv) {
+    int repetitions = 5;
+    int numThreads = 1;
+    int deterministic = 0;
+    double d = 0.85;
+    double diffPR = 0.0001;
+    int maxIterations = 1000;
+    const char *outputPath = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "r:t:o:Dc")) != -1) {
+        switch (opt) {
+        case 'r': repetitions = atoi(optarg); break;
+        case 't': numThreads = atoi(optarg); break;
+        case 'o': outputPath = optarg; break;
+        case 'D': deterministic = 1; break;
+        case 'c':
+            if (argc - optind != 2) {
+                fprintf(stderr, "Usage: %s -c old.jsonl new.jsonl\n", argv[0]);
+                return 1;
+            }
+            return compareResults(argv[optind], argv[optind + 1]);
+        default:
+            benchUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind >= argc || repetitions < 1 || repetitions > MAX_REPETITIONS) {
+        benchUsage(argv[0]);
+        return 1;
+    }
+
+    FILE *output = stdout;
+    if (outputPath) {
+        output = fopen(outputPath, "w");
+        if (!output) {
+            perror("Error opening benchmark output");
+            return 1;
+        }
+    }
+
+    // Scratch directory for the pagerankList.txt of the write phases
+    char scratchPath[] = "/tmp/benchPagerank.XXXXXX";
+    int scratch = mkdtemp(scratchPath) ? open(scratchPath, O_RDONLY) : -1;
+    if (scratch < 0) {
+        perror("Error creating scratch directory");
+        return 1;
+    }
+
+    RankOptions options = { numThreads, 0, HUGE_PAGES_OFF, 0, NULL, 0, NULL, NULL, 0, 0, 0,
+                            RANK_DOUBLE, DANGLING_DROP, 0, 0, PUSH_OFF, 0,
+                            SCHEDULE_DEFAULT, deterministic };
+    for (int i = optind; i < argc; i++) {
+        struct stat st;
+        if (stat(argv[i], &st) != 0) {
+            perror(argv[i]);
+            return 1;
+        }
+        if (S_ISDIR(st.st_mode)) {
+            benchmarkDataset(argv[i], repetitions, &options, d, diffPR, maxIterations, scratch,
+                             output);
+        } else {
+            benchmarkEdgeFile(argv[i], repetitions, d, diffPR, maxIterations, scratch, output);
+        }
+    }
+
+    unlinkat(scratch, "pagerankList.txt", 0);
+    close(scratch);
+    rmdir(scratchPath);
+
+    if (output != stdout) {
+        fclose(output);
+    }
+    return 0;
+}
+
+void benchUsage(const char *program) {
+    fprintf(stderr, "Usage: %s [-r repetitions] [-t threads] [-o output.jsonl] "
+            "[-D] collectionDir|edgeFile...\n"
+            "       %s -c old.jsonl new.jsonl\n", program, program);
+}
+
+int compareDoubles(const void *a, const void *b) {
+    double diff = *(const double *)a - *(const double *)b;
+    return (diff > 0) - (diff < 0);
+}
+
+// Function to pick the q-quantile of sorted samples (nearest rank)
+double percentile(const double sorted[], int count, double q) {
+    int rank = (int)ceil(q * count);
+    if (rank < 1) {
+        rank = 1;
+    }
+    return sorted[rank - 1];
+}
+
+void reportResult(BenchResult *result, FILE *output) {
+    qsort(result->times, result->repetitions, sizeof(double), compareDoubles);
+
+    double total = 0.0;
+    for (int k = 0; k < result->repetitions; k++) {
+        total += result->times[k];
+    }
+    double mean = total / result->repetitions;
+    double p50 = percentile(result->times, result->repetitions, 0.50);
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    fprintf(output, "{\"dataset\":\"%s\",\"phase\":\"%s\",\"pages\":%d,\"edges\":%ld,"
+            "\"repetitions\":%d,\"mean_s\":%.9f,\"min_s\":%.9f,\"p50_s\":%.9f,"
+            "\"p90_s\":%.9f,\"p99_s\":%.9f,",
+            result->dataset, result->phase, result->N, result->edges,
+            result->repetitions, mean, result->times[0], p50,
+            percentile(result->times, result->repetitions, 0.90),
+            percentile(result->times, result->repetitions, 0.99));
+    if (result->workPerRun > 0) {
+        fprintf(output, "\"edges_per_s\":%.1f,", p50 > 0 ? result->workPerRun / p50 : 0.0);
+    }
+    fprintf(output, "\"pages_per_s\":%.1f,\"process_peak_rss_kb\":%ld}\n",
+            p50 > 0 ? result->N / p50 : 0.0, usage.ru_maxrss);
+    fflush(output);
+}
+
+// Function to benchmark every phase on the collection in one directory
+void benchmarkDataset(const char *dataset, int repetitions, const RankOptions *options,
+                      double d, double diffPR, int maxIterations, int scratch, FILE *output) {
+    int cwd = open(".", O_RDONLY);
+    if (cwd < 0 || chdir(dataset) != 0) {
+        perror("Error entering collection directory");
+        exit(1);
+    }
+
+    Page *pages = malloc(MAX_URLS * sizeof(Page));
+    if (!pages) {
+        perror("Error allocating pages");
+        exit(1);
+    }
+
+    BenchResult result;
+    memset(&result, 0, sizeof(result));
+    result.dataset = dataset;
+    result.repetitions = repetitions;
+
+    // parse
+    int N = 0;
+    for (int k = 0; k < repetitions; k++) {
+        double start = wallSeconds();
+        N = readCollection(pages, MAX_URLS);
+        result.times[k] = wallSeconds() - start;
+    }
+
+    // build
+    Graph graph;
+    buildGraph(pages, N, &graph);
+    result.N = N;
+    result.edges = graph.numEdges;
+    result.workPerRun = graph.numEdges;
+    result.phase = "parse";
+    reportResult(&result, output);
+
+    for (int k = 0; k < repetitions; k++) {
+        Graph copy;
+        double start = wallSeconds();
+        buildGraph(pages, N, &copy);
+        result.times[k] = wallSeconds() - start;
+        freeGraph(&copy);
+    }
+    result.phase = "build";
+    reportResult(&result, output);
+
+    // iterate
+    double *contrib = malloc((N > 0 ? N : 1) * sizeof(double));
+    double *nextContrib = malloc((N > 0 ? N : 1) * sizeof(double));
+    double *pageRank = malloc((N > 0 ? N : 1) * sizeof(double));
+    if (!contrib || !nextContrib || !pageRank) {
+        perror("Error allocating rank vectors");
+        exit(1);
+    }
+    for (int i = 0; i < N; i++) {
+        pageRank[i] = 1.0 / N;
+        contrib[i] = graph.outDegree[i] != 0 ? pageRank[i] / graph.outDegree[i] : 0.0;
+    }
+    int indexBytes;
+    RankKernel kernel = selectRankKernel(&graph, options->rankType, options->dangling,
+                                         options->indexWidth, &indexBytes);
+    KernelArgs args;
+    memset(&args, 0, sizeof(args));
+    args.graph = &graph;
+    args.contrib = contrib;
+    args.nextContrib = nextContrib;
+    args.pageRank = pageRank;
+    args.lo = 0;
+    args.hi = N;
+    args.d = d;
+    for (int k = 0; k < repetitions; k++) {
+        double start = wallSeconds();
+        kernel(&args);
+        result.times[k] = wallSeconds() - start;
+    }
+    result.phase = "iterate";
+    reportResult(&result, output);
+
+    // converge
+    Telemetry telemetry;
+    memset(&telemetry, 0, sizeof(telemetry));
+    RankOptions convergeOptions = *options;
+    convergeOptions.telemetry = &telemetry;
+    for (int k = 0; k < repetitions; k++) {
+        for (int i = 0; i < N; i++) {
+            pages[i].pageRank = 1.0 / N;
+        }
+        double start = wallSeconds();
+        calculatePageRank(pages, N, d, diffPR, maxIterations, &convergeOptions);
+        result.times[k] = wallSeconds() - start;
+    }
+    result.phase = "converge";
+    result.workPerRun = (double)graph.numEdges * telemetry.iterations;
+    reportResult(&result, output);
+
+    // write
+    if (fchdir(scratch) != 0) {
+        perror("Error entering scratch directory");
+        exit(1);
+    }
+    for (int k = 0; k < repetitions; k++) {
+        double start = wallSeconds();
+        writePageRankToFile(pages, N, NULL);
+        result.times[k] = wallSeconds() - start;
+    }
+    result.phase = "write";
+    result.workPerRun = 0;
+    reportResult(&result, output);
+
+    free(contrib);
+    free(nextContrib);
+    free(pageRank);
+    freeGraph(&graph);
+    free(pages);
+
+    if (fchdir(cwd) != 0) {
+        perror("Error leaving collection directory");
+        exit(1);
+    }
+    close(cwd);
+}
+
+// Function to get the wall time of a phase from telemetry written to a file
+double phaseSeconds(FILE *telemetry, const char *phase) {
+    char line[256];
+    char name[64];
+    double seconds;
+    rewind(telemetry);
+    while (fgets(line, sizeof(line), telemetry)) {
+        if (sscanf(line, "{\"event\":\"phase\",\"phase\":\"%63[^\"]\",\"wall_s\":%lf",
+                   name, &seconds) == 2 && strcmp(name, phase) == 0) {
+            return seconds;
+        }
+    }
+    return 0.0;
+}
+
+// Function to benchmark the out-of-core iteration on a binary edge file. The
+// phases are timed by the telemetry of calculatePageRankOutOfCore.
+void benchmarkEdgeFile(const char *dataset, int repetitions, double d, double diffPR,
+                       int maxIterations, int scratch, FILE *output) {
+    EdgeFileHeader header;
+    FILE *file = fopen(dataset, "rb");
+    if (!file || fread(&header, sizeof(header), 1, file) != 1 ||
+        memcmp(header.magic, EDGE_FILE_MAGIC, sizeof(header.magic)) != 0) {
+        fprintf(stderr, "Error: %s is neither a collection directory nor an edge file\n",
+                dataset);
+        exit(1);
+    }
+    fclose(file);
+
+    // The iteration writes pagerankList.txt to the working directory
+    char *path = realpath(dataset, NULL);
+    int cwd = open(".", O_RDONLY);
+    if (!path || cwd < 0 || fchdir(scratch) != 0) {
+        perror("Error entering scratch directory");
+        exit(1);
+    }
+
+    BenchResult load;
+    BenchResult converge;
+    memset(&load, 0, sizeof(load));
+    load.dataset = dataset;
+    load.phase = "load";
+    load.N = header.numPages;
+    load.edges = header.numEdges;
+    load.repetitions = repetitions;
+    converge = load;
+    converge.phase = "converge";
+
+    for (int k = 0; k < repetitions; k++) {
+        Telemetry telemetry;
+        memset(&telemetry, 0, sizeof(telemetry));
+        telemetry.file = tmpfile();
+        if (!telemetry.file) {
+            perror("Error creating telemetry file");
+            exit(1);
+        }
+        calculatePageRankOutOfCore(path, d, diffPR, maxIterations, 0, &telemetry);
+        load.times[k] = phaseSeconds(telemetry.file, "parse");
+        converge.times[k] = telemetry.iterateSeconds;
+        converge.workPerRun = (double)header.numEdges * telemetry.iterations;
+        fclose(telemetry.file);
+    }
+    reportResult(&load, output);
+    reportResult(&converge, output);
+
+    free(path);
+    if (fchdir(cwd) != 0) {
+        perror("Error leaving scratch directory");
+        exit(1);
+    }
+    close(cwd);
+}
+
+// Function to print the change of the median time of every phase between
+// two benchmark outputs
+int compareResults(const char *oldPath, const char *newPath) {
+    FILE *oldFile = fopen(oldPath, "r");
+    FILE *newFile = fopen(newPath, "r");
+    if (!oldFile || !newFile) {
+        perror("Error opening benchmark results");
+        return 1;
+    }
+
+    char newLine[1024];
+    while (fgets(newLine, sizeof(newLine), newFile)) {
+        char dataset[512], phase[64];
+        double newP50;
+        if (sscanf(newLine, "{\"dataset\":\"%511[^\"]\",\"phase\":\"%63[^\"]\"",
+                   dataset, phase) != 2) {
+            continue;
+        }
+        char *field = strstr(newLine, "\"p50_s\":");
+        if (!field || sscanf(field, "\"p50_s\":%lf", &newP50) != 1) {
+            continue;
+        }
+
+        char oldLine[1024];
+        double oldP50 = -1;
+        rewind(oldFile);
+        while (fgets(oldLine, sizeof(oldLine), oldFile)) {
+            char oldDataset[512], oldPhase[64];
+            if (sscanf(oldLine, "{\"dataset\":\"%511[^\"]\",\"phase\":\"%63[^\"]\"",
+                       oldDataset, oldPhase) == 2 &&
+                strcmp(oldDataset, dataset) == 0 && strcmp(oldPhase, phase) == 0) {
+                field = strstr(oldLine, "\"p50_s\":");
+                if (field) {
+                    sscanf(field, "\"p50_s\":%lf", &oldP50);
+                }
+                break;
+            }
+        }
+
+        if (oldP50 > 0) {
+            printf("%-30s %-9s %12.6f -> %12.6f s  (%+.1f%%)\n", dataset, phase,
+                   oldP50, newP50, (newP50 / oldP50 - 1) * 100);
+        } else {
+            printf("%-30s %-9s %12s -> %12.6f s\n", dataset, phase, "-", newP50);
+        }
+    }
+
+    fclose(oldFile);
+    fclose(newFile);
+    return 0;
+}
@@ -0,0 +1,33 @@
+// edgeFile.h
+//
+// Binary edge file shared by `pagerank` and `generateCollection`. It holds
+// a whole graph snapshot: the out-degree of every page, its links sorted by
+// (src, dst) and the page URLs. Layout:
+//
+//    EdgeFileHeader
+//    uint32_t outDegree[numPages]
+//    Edge     edges[numEdges]         sorted by (src, dst)
+//    char     urls[]                  numPages NUL-terminated strings
+//
+#ifndef EDGE_FILE_H
+#define EDGE_FILE_H
+
+#include <stdint.h>
+
+#define EDGE_FILE_MAGIC "PRE1"
+#define EDGE_FILE_VERSION 1
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint64_t numPages;
+    uint64_t numEdges;
+    uint64_t urlTableOffset;
+} EdgeFileHeader;
+
+typedef struct {
+    uint32_t src;
+    uint32_t dst;
+} Edge;
+
+#endif
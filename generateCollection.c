@@ -0,0 +1,505 @@
+// generateCollection.c
+//
+// This program generates synthetic web graphs for benchmarking the search
+// engine at scale.
+//
+// Links are drawn from one of three models:
+//
+//    rmat        R-MAT: each link picks a quadrant of the adjacency matrix
+//                recursively with probabilities (a, b, c, d)
+//    kronecker   Stochastic Kronecker graph with the same 2x2 initiator,
+//                perturbed by random noise at every level to smooth the
+//                degree distribution
+//    ba          Barabasi-Albert preferential attachment: every new page
+//                links to earlier pages chosen in proportion to their degree
+//
+// Self-links and duplicate links are dropped, and a chosen fraction of the
+// pages is left dangling (without out-links).
+//
+// The graph is written in the project's input format: `collection.txt`
+// plus one `urlN.txt` per page holding its links in Section-1 and text in
+// Section-2, drawn from a Zipfian vocabulary. It can also be written as a
+// binary edge file (see edgeFile.h) for `pagerank --edge-file`.
+//
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "edgeFile.h"
+
+#define MAX_URL_LENGTH 100
+// Keep Section-1 lines well below the 1000-byte line buffer of pagerank
+#define MAX_LINE_LENGTH 80
+// MAX_URLS of pagerank.c, which ignores the pages of a collection past it
+#define PAGERANK_MAX_URLS 1000
+
+enum {
+    MODEL_RMAT,
+    MODEL_KRONECKER,
+    MODEL_BA
+};
+
+typedef struct {
+    long numPages;
+    long numEdges;
+    int model;
+    double skew;            // R-MAT/Kronecker a, or BA preferential probability
+    double noise;           // Kronecker noise level
+    double danglingFraction;
+    const char *directory;
+    const char *edgeFile;
+    int writeText;
+    long vocabularySize;
+    double zipfExponent;
+    int wordsPerPage;
+    uint64_t seed;
+} GeneratorOptions;
+
+typedef struct {
+    Edge *edges;
+    long count;
+    long capacity;
+} EdgeList;
+
+// Function prototypes
+uint64_t nextRandom(uint64_t *state);
+double uniformRandom(uint64_t *state);
+void addEdge(EdgeList *list, uint32_t src, uint32_t dst);
+void generateRmat(const GeneratorOptions *options, EdgeList *list, uint64_t *state);
+void generateBarabasiAlbert(const GeneratorOptions *options, EdgeList *list, uint64_t *state);
+void removeDanglingSources(const GeneratorOptions *options, EdgeList *list, uint64_t *state);
+int compareEdges(const void *a, const void *b);
+void sortAndDeduplicate(EdgeList *list);
+void makeWord(long index, char *word);
+double *buildZipfTable(long vocabularySize, double exponent);
+long sampleZipf(const double cdf[], long vocabularySize, uint64_t *state);
+void writeTextCollection(const GeneratorOptions *options, const EdgeList *list, uint64_t *state);
+void writeBinaryEdgeFile(const GeneratorOptions *options, const EdgeList *list);
+void usage(const char *program);
+
+int main(int argc, char **argv) {
+    GeneratorOptions options = {
+        1000, 0, MODEL_RMAT, -1.0, 0.1, 0.0, ".", NULL, 1, 10000, 1.0, 100, 1
+    };
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:e:m:s:x:g:d:b:Tv:z:w:r:")) != -1) {
+        switch (opt) {
+        case 'n': options.numPages = atol(optarg); break;
+        case 'e': options.numEdges = atol(optarg); break;
+        case 'm':
+            if (strcmp(optarg, "rmat") == 0) {
+                options.model = MODEL_RMAT;
+            } else if (strcmp(optarg, "kronecker") == 0) {
+                options.model = MODEL_KRONECKER;
+            } else if (strcmp(optarg, "ba") == 0) {
+                options.model = MODEL_BA;
+            } else {
+                fprintf(stderr, "Unknown model: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 's':
+            options.skew = atof(optarg);
+            if (options.skew < 0 || options.skew > 1) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'x': options.noise = atof(optarg); break;
+        case 'g': options.danglingFraction = atof(optarg); break;
+        case 'd': options.directory = optarg; break;
+        case 'b': options.edgeFile = optarg; break;
+        case 'T': options.writeText = 0; break;
+        case 'v': options.vocabularySize = atol(optarg); break;
+        case 'z': options.zipfExponent = atof(optarg); break;
+        case 'w': options.wordsPerPage = atoi(optarg); break;
+        case 'r': options.seed = strtoull(optarg, NULL, 10); break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind != argc || options.numPages < 1 || options.numPages > UINT32_MAX ||
+        options.danglingFraction < 0 || options.danglingFraction > 1 ||
+        options.vocabularySize < 1 || options.wordsPerPage < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (options.numEdges <= 0) {
+        options.numEdges = options.numPages * 8;
+    }
+    if (options.skew < 0) {
+        options.skew = options.model == MODEL_BA ? 1.0 : 0.57;
+    }
+
+    uint64_t state = options.seed;
+    EdgeList list = { NULL, 0, 0 };
+    if (options.model == MODEL_BA) {
+        generateBarabasiAlbert(&options, &list, &state);
+    } else {
+        generateRmat(&options, &list, &state);
+    }
+    removeDanglingSources(&options, &list, &state);
+    sortAndDeduplicate(&list);
+    fprintf(stderr, "Generated %ld pages, %ld links\n", options.numPages, list.count);
+
+    if (options.writeText) {
+        if (options.numPages > PAGERANK_MAX_URLS) {
+            fprintf(stderr, "Warning: pagerank reads at most %d pages of a text collection; "
+                    "use -b and pagerank --edge-file for %ld pages\n",
+                    PAGERANK_MAX_URLS, options.numPages);
+        }
+        writeTextCollection(&options, &list, &state);
+    }
+    if (options.edgeFile) {
+        writeBinaryEdgeFile(&options, &list);
+    }
+
+    free(list.edges);
+    return 0;
+}
+
+void usage(const char *program) {
+    fprintf(stderr,
+            "Usage: %s [-n pages] [-e links] [-m rmat|kronecker|ba] [-s skew]\n"
+            "          [-x noise] [-g danglingFraction] [-d directory] [-b edgeFile]\n"
+            "          [-T] [-v vocabularySize] [-z zipfExponent] [-w wordsPerPage]\n"
+            "          [-r seed]\n"
+            "\n"
+            "  -s  R-MAT/Kronecker probability a (default 0.57), or the probability\n"
+            "      that a BA link is preferential rather than uniform (default 1),\n"
+            "      between 0 and 1\n"
+            "  -g  fraction of pages without out-links, between 0 and 1 (default 0)\n"
+            "  -x  Kronecker noise level (default 0.1)\n"
+            "  -T  do not write collection.txt and the urlN.txt files\n",
+            program);
+}
+
+// splitmix64, so that a seed always generates the same collection
+uint64_t nextRandom(uint64_t *state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+double uniformRandom(uint64_t *state) {
+    return (nextRandom(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+void addEdge(EdgeList *list, uint32_t src, uint32_t dst) {
+    if (src == dst) {
+        return;
+    }
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 1024;
+        list->edges = realloc(list->edges, list->capacity * sizeof(Edge));
+        if (!list->edges) {
+            perror("Error allocating edges");
+            exit(1);
+        }
+    }
+    list->edges[list->count].src = src;
+    list->edges[list->count].dst = dst;
+    list->count++;
+}
+
+// Function to generate R-MAT or Kronecker links. Both descend the adjacency
+// matrix one bit of the page ids at a time; the Kronecker model perturbs
+// the initiator at every level. Links landing outside the page range are
+// drawn again.
+void generateRmat(const GeneratorOptions *options, EdgeList *list, uint64_t *state) {
+    int levels = 0;
+    while ((1L << levels) < options->numPages) {
+        levels++;
+    }
+
+    double a = options->skew;
+    double b = (1 - a) * 19 / 43;
+    double c = b;
+    double d = (1 - a) * 5 / 43;
+
+    double *levelA = malloc((levels + 1) * sizeof(double));
+    double *levelB = malloc((levels + 1) * sizeof(double));
+    double *levelC = malloc((levels + 1) * sizeof(double));
+    double *levelD = malloc((levels + 1) * sizeof(double));
+    if (!levelA || !levelB || !levelC || !levelD) {
+        perror("Error allocating initiator");
+        exit(1);
+    }
+    for (int level = 0; level < levels; level++) {
+        levelA[level] = a;
+        levelB[level] = b;
+        levelC[level] = c;
+        levelD[level] = d;
+        if (options->model == MODEL_KRONECKER) {
+            double mu = options->noise * (2 * uniformRandom(state) - 1) * fmin(a, d);
+            levelA[level] = a - 2 * mu * a / (a + d);
+            levelB[level] = b + mu;
+            levelC[level] = c + mu;
+            levelD[level] = d - 2 * mu * d / (a + d);
+        }
+    }
+
+    long attempts = 0;
+    while (list->count < options->numEdges && attempts < options->numEdges * 4) {
+        attempts++;
+        uint64_t src = 0;
+        uint64_t dst = 0;
+        for (int level = 0; level < levels; level++) {
+            double r = uniformRandom(state);
+            int row = 0;
+            int col = 0;
+            if (r < levelA[level]) {
+                // top-left
+            } else if (r < levelA[level] + levelB[level]) {
+                col = 1;
+            } else if (r < levelA[level] + levelB[level] + levelC[level]) {
+                row = 1;
+            } else {
+                row = 1;
+                col = 1;
+            }
+            src = (src << 1) | row;
+            dst = (dst << 1) | col;
+        }
+        if ((long)src < options->numPages && (long)dst < options->numPages) {
+            addEdge(list, src, dst);
+        }
+    }
+
+    free(levelA);
+    free(levelB);
+    free(levelC);
+    free(levelD);
+}
+
+// Function to generate Barabasi-Albert links. Every page after the first
+// links to m = links / pages earlier pages. A target is drawn uniformly
+// with probability 1 - skew, otherwise from the list of link endpoints so
+// far, which picks pages in proportion to their degree.
+void generateBarabasiAlbert(const GeneratorOptions *options, EdgeList *list, uint64_t *state) {
+    long m = options->numEdges / options->numPages;
+    if (m < 1) {
+        m = 1;
+    }
+
+    uint32_t *endpoints = malloc((2 * m * options->numPages + 1) * sizeof(uint32_t));
+    if (!endpoints) {
+        perror("Error allocating endpoints");
+        exit(1);
+    }
+    long numEndpoints = 0;
+    endpoints[numEndpoints++] = 0;
+
+    for (long page = 1; page < options->numPages; page++) {
+        long links = m < page ? m : page;
+        for (long k = 0; k < links; k++) {
+            uint32_t target;
+            if (uniformRandom(state) < options->skew) {
+                target = endpoints[nextRandom(state) % numEndpoints];
+            } else {
+                target = nextRandom(state) % page;
+            }
+            addEdge(list, page, target);
+            endpoints[numEndpoints++] = page;
+            endpoints[numEndpoints++] = target;
+        }
+    }
+    free(endpoints);
+}
+
+// Function to drop every link whose source was chosen to be dangling
+void removeDanglingSources(const GeneratorOptions *options, EdgeList *list, uint64_t *state) {
+    if (options->danglingFraction <= 0) {
+        return;
+    }
+
+    unsigned char *dangling = malloc(options->numPages);
+    if (!dangling) {
+        perror("Error allocating dangling flags");
+        exit(1);
+    }
+    for (long i = 0; i < options->numPages; i++) {
+        dangling[i] = uniformRandom(state) < options->danglingFraction;
+    }
+
+    long kept = 0;
+    for (long k = 0; k < list->count; k++) {
+        if (!dangling[list->edges[k].src]) {
+            list->edges[kept++] = list->edges[k];
+        }
+    }
+    list->count = kept;
+    free(dangling);
+}
+
+int compareEdges(const void *a, const void *b) {
+    const Edge *ea = (const Edge *)a;
+    const Edge *eb = (const Edge *)b;
+    if (ea->src != eb->src) {
+        return (ea->src > eb->src) - (ea->src < eb->src);
+    }
+    return (ea->dst > eb->dst) - (ea->dst < eb->dst);
+}
+
+void sortAndDeduplicate(EdgeList *list) {
+    qsort(list->edges, list->count, sizeof(Edge), compareEdges);
+
+    long kept = 0;
+    for (long k = 0; k < list->count; k++) {
+        if (kept == 0 || compareEdges(&list->edges[kept - 1], &list->edges[k]) != 0) {
+            list->edges[kept++] = list->edges[k];
+        }
+    }
+    list->count = kept;
+}
+
+// Function to spell vocabulary word number index. Words are built from
+// consonant-vowel syllables so they look like text and never like a URL.
+void makeWord(long index, char *word) {
+    static const char consonants[] = "bcdfghjklmnprstvwz";
+    static const char vowels[] = "aeiou";
+    int length = 0;
+    do {
+        long syllable = index % (18 * 5);
+        word[length++] = consonants[syllable / 5];
+        word[length++] = vowels[syllable % 5];
+        index /= 18 * 5;
+    } while (index > 0);
+    word[length] = '\0';
+}
+
+// Function to build the cumulative distribution of a Zipf law with the
+// given exponent over the vocabulary
+double *buildZipfTable(long vocabularySize, double exponent) {
+    double *cdf = malloc(vocabularySize * sizeof(double));
+    if (!cdf) {
+        perror("Error allocating vocabulary");
+        exit(1);
+    }
+    double total = 0.0;
+    for (long k = 0; k < vocabularySize; k++) {
+        total += 1.0 / pow(k + 1, exponent);
+        cdf[k] = total;
+    }
+    for (long k = 0; k < vocabularySize; k++) {
+        cdf[k] /= total;
+    }
+    return cdf;
+}
+
+long sampleZipf(const double cdf[], long vocabularySize, uint64_t *state) {
+    double r = uniformRandom(state);
+    long lo = 0;
+    long hi = vocabularySize - 1;
+    while (lo < hi) {
+        long mid = (lo + hi) / 2;
+        if (cdf[mid] < r) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// Function to write collection.txt and one urlN.txt file per page
+void writeTextCollection(const GeneratorOptions *options, const EdgeList *list, uint64_t *state) {
+    mkdir(options->directory, 0755);
+
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/collection.txt", options->directory);
+    FILE *collection = fopen(path, "w");
+    if (!collection) {
+        perror("Error opening collection.txt");
+        exit(1);
+    }
+    for (long i = 0; i < options->numPages; i++) {
+        fprintf(collection, "url%ld\n", i);
+    }
+    fclose(collection);
+
+    double *cdf = buildZipfTable(options->vocabularySize, options->zipfExponent);
+    long k = 0;
+    for (long i = 0; i < options->numPages; i++) {
+        snprintf(path, sizeof(path), "%s/url%ld.txt", options->directory, i);
+        FILE *file = fopen(path, "w");
+        if (!file) {
+            perror("Error opening URL file");
+            exit(1);
+        }
+
+        fprintf(file, "#start Section-1\n");
+        int lineLength = 0;
+        for (; k < list->count && list->edges[k].src == i; k++) {
+            char url[MAX_URL_LENGTH];
+            int length = snprintf(url, sizeof(url), "url%u", list->edges[k].dst);
+            if (lineLength > 0 && lineLength + 1 + length > MAX_LINE_LENGTH) {
+                fprintf(file, "\n");
+                lineLength = 0;
+            }
+            lineLength += fprintf(file, lineLength > 0 ? " %s" : "%s", url);
+        }
+        fprintf(file, "\n#end Section-1\n\n#start Section-2\n");
+
+        lineLength = 0;
+        for (int w = 0; w < options->wordsPerPage; w++) {
+            char word[32];
+            makeWord(sampleZipf(cdf, options->vocabularySize, state), word);
+            int length = strlen(word);
+            if (lineLength > 0 && lineLength + 1 + length > MAX_LINE_LENGTH) {
+                fprintf(file, "\n");
+                lineLength = 0;
+            }
+            lineLength += fprintf(file, lineLength > 0 ? " %s" : "%s", word);
+        }
+        fprintf(file, "\n#end Section-2\n");
+        fclose(file);
+    }
+    free(cdf);
+}
+
+// Function to write the graph as a binary edge file for pagerank
+void writeBinaryEdgeFile(const GeneratorOptions *options, const EdgeList *list) {
+    FILE *file = fopen(options->edgeFile, "wb");
+    if (!file) {
+        perror("Error opening edge file");
+        exit(1);
+    }
+
+    uint32_t *outDegree = calloc(options->numPages, sizeof(uint32_t));
+    if (!outDegree) {
+        perror("Error allocating out-degrees");
+        exit(1);
+    }
+    for (long k = 0; k < list->count; k++) {
+        outDegree[list->edges[k].src]++;
+    }
+
+    EdgeFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, EDGE_FILE_MAGIC, sizeof(header.magic));
+    header.version = EDGE_FILE_VERSION;
+    header.numPages = options->numPages;
+    header.numEdges = list->count;
+    header.urlTableOffset = sizeof(EdgeFileHeader) + options->numPages * sizeof(uint32_t) +
+                            list->count * sizeof(Edge);
+    fwrite(&header, sizeof(header), 1, file);
+    fwrite(outDegree, sizeof(uint32_t), options->numPages, file);
+    fwrite(list->edges, sizeof(Edge), list->count, file);
+    for (long i = 0; i < options->numPages; i++) {
+        fprintf(file, "url%ld%c", i, '\0');
+    }
+
+    if (ferror(file) || fclose(file) != 0) {
+        perror("Error writing edge file");
+        exit(1);
+    }
+    free(outDegree);
+}
@@ -0,0 +1,82 @@
+// indexFile.h
+//
+// Binary inverted index written by `invertedIndex --binary` and memory-mapped
+// by `searchPagerank --binary`. Layout:
+//
+//    IndexFileHeader
+//    uint32_t  docOffsets[numDocs + 1]  start of every name in names[]
+//    char      names[]                  numDocs NUL-terminated URLs, sorted
+//    (padding to 8 bytes)
+//    uint8_t   postings[]               per term, its ascending doc ids as
+//                                       LEB128 varints of the gaps between
+//                                       them (the first id is a gap from 0);
+//                                       with INDEX_FILE_POSITIONS each gap g
+//                                       is stored as 2g + 1 when the term
+//                                       occurs once in the document, else as
+//                                       2g followed by the term frequency;
+//                                       then come the gaps between the
+//                                       ascending positions of the term (the
+//                                       first from 0), also varints
+//    (padding to 8 bytes)
+//    IndexTerm terms[numTerms]          sorted by word
+//    char      words[]                  numTerms NUL-terminated words
+//
+// Offsets in the header are from the start of the file. The body checksum
+// covers every byte after the header; the header checksum covers the header
+// up to itself. Both are CRC-32 (IEEE).
+//
+#ifndef INDEX_FILE_H
+#define INDEX_FILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define INDEX_FILE_MAGIC "IIX1"
+#define INDEX_FILE_VERSION 2
+
+// Flags of the index file
+#define INDEX_FILE_POSITIONS 1      // postings hold frequencies and positions
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t flags;
+    uint32_t numDocs;
+    uint32_t numTerms;
+    uint32_t reserved;
+    uint64_t namesOffset;
+    uint64_t postingsOffset;
+    uint64_t termsOffset;
+    uint64_t wordsOffset;
+    uint64_t fileSize;
+    uint32_t bodyChecksum;
+    uint32_t headerChecksum;
+} IndexFileHeader;
+
+typedef struct {
+    uint64_t postingsOffset;    // from the start of the postings section
+    uint32_t wordOffset;        // from the start of the words section
+    uint32_t docCount;
+} IndexTerm;
+
+// Function to continue a CRC-32 over length more bytes; start from 0
+static uint32_t indexChecksum(uint32_t crc, const void *data, size_t length) {
+    static uint32_t table[256];
+    if (table[1] == 0) {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            table[i] = c;
+        }
+    }
+    const unsigned char *bytes = data;
+    crc = ~crc;
+    for (size_t i = 0; i < length; i++) {
+        crc = table[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+#endif
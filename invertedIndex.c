@@ -8,7 +8,32 @@
 // efficient term-based searching.
 //
 // The program reads input from `collection.txt`, normalizes words (removing 
-// punctuation and converting to lowercase), and stores them in a binary search tree. 
+// punctuation and converting to lowercase), and stores them in a hash table
+// of terms. The terms are sorted once when the index is written. Term strings,
+// document names and postings are bump-allocated from an arena, and postings
+// refer to documents by 32-bit ids into a single document table. Postings are
+// appended in collection order; the documents are renumbered in filename
+// order once all files are parsed.
+//
+// With `--threads N` the collection is cut into N contiguous slices of about
+// the same number of bytes. Each thread indexes its slice into a partial
+// index of its own and sorts its terms. The sorted partial indexes are then
+// merged by term in parallel, each thread merging one range of the terms.
+//
+// With `--memory-budget MB` a thread whose index outgrows its share of the
+// budget writes the index as a sorted run to a temporary file and starts
+// again with an empty one. Once every document is parsed, the runs of all
+// threads are merged term by term straight into `invertedIndex.txt`.
+//
+// `--binary` also writes the index to `invertedIndex.bin` in the compressed
+// format of indexFile.h, for `searchPagerank --binary`. `--positions` adds
+// the positions of every term in every document to the binary index, for
+// phrase and proximity queries. A position counts every word of the file.
+//
+// Every file is read whole into a buffer and tokenized in place: a SIMD pass
+// marks the whitespace and uppercase bytes in bitmasks and lowercases the
+// buffer, and the words are then cut out of it between whitespace bits.
+// `--scalar-tokenizer` parses with `fscanf` a word at a time instead.
 // The output is written to `invertedIndex.txt`
 // in **alphabetical order**, showing each word followed by the list of URLs 
 // where it appears.
@@ -17,35 +42,265 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "indexFile.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #define MAX_WORD_LENGTH 1000
 #define MAX_FILENAME_LENGTH 100
+#define INITIAL_TABLE_SIZE 1024
+#define INITIAL_DOC_CAPACITY 1024
+#define INITIAL_POSTING_CAPACITY 2
+#define ARENA_BLOCK_SIZE (1 << 20)
+#define INITIAL_TEXT_CAPACITY (1 << 16)
 
-// Linked list for filenames
-typedef struct FileNode {
-    char filename[MAX_FILENAME_LENGTH];
-    struct FileNode *next;
-} FileNode;
+// Block of arena memory; blocks are chained and freed together
+typedef struct ArenaBlock {
+    struct ArenaBlock *next;
+    size_t used;
+    size_t size;
+    char data[];
+} ArenaBlock;
 
-// Node for the binary search tree
-typedef struct TreeNode {
-    char word[MAX_WORD_LENGTH];
-    FileNode *fileList;
-    struct TreeNode *left;
-    struct TreeNode *right;
-} TreeNode;
+// Bump allocator for everything that lives as long as the index
+typedef struct {
+    ArenaBlock *head;
+    size_t bytes;           // bytes handed out
+} Arena;
+
+// Growable array of the documents a term appears in, in the order they were
+// parsed. Every document is a record of its id, followed in a positional
+// index by the number of positions of the term and the positions.
+typedef struct {
+    uint32_t *values;
+    uint32_t count;         // values in use
+    uint32_t capacity;
+    uint32_t docCount;
+    uint32_t last;          // start of the record of the last document
+} PostingList;
+
+// Term of the dictionary with the documents it appears in
+typedef struct {
+    char *word;             // NULL for an empty slot
+    unsigned long hash;
+    PostingList postings;
+} TermEntry;
+
+// Open-addressing hash table of terms with linear probing. The capacity is
+// a power of two and kept at least twice the number of terms.
+typedef struct {
+    TermEntry *entries;
+    size_t capacity;
+    size_t count;
+} TermTable;
+
+// Names of the documents, indexed by document id
+typedef struct {
+    char **names;
+    uint32_t count;
+    uint32_t capacity;
+    Arena arena;
+} DocTable;
+
+// Document name with its id, for sorting the document table
+typedef struct {
+    char *name;
+    uint32_t docId;
+} DocOrder;
+
+// Terms of the documents one thread has parsed
+typedef struct {
+    TermTable terms;
+    Arena arena;
+    int positional;
+} InvertedIndex;
+
+// Term of a sorted run file whose posting list is the next thing to read
+typedef struct {
+    FILE *file;
+    char *word;
+    uint32_t wordCapacity;
+    uint32_t count;         // number of values of the current term
+    uint32_t docCount;
+} RunReader;
+
+// Read position of the merge in the sorted terms of one partial index
+typedef struct {
+    TermEntry **run;
+    size_t pos;
+    size_t end;
+} MergeCursor;
+
+// Document read whole for tokenizing. The text is lowercased in place; bit i
+// of space and upper tells whether byte i was whitespace or an uppercase
+// letter before that. Every bit after the text is a whitespace bit.
+typedef struct {
+    char *text;
+    size_t length;
+    size_t capacity;            // text bytes, one more than the longest text
+    uint64_t *space;
+    uint64_t *upper;
+    size_t maskWords;           // words of each mask in use
+    size_t maskCapacity;
+    size_t next;                // where the next word is looked for
+    uint32_t position;          // words cut so far
+} TokenScanner;
+
+struct IndexBuilder;
+
+typedef struct {
+    pthread_t thread;
+    int id;
+    struct IndexBuilder *builder;
+    uint32_t firstDoc;          // slice of the document table to parse
+    uint32_t lastDoc;
+    InvertedIndex partial;
+    TermEntry **run;            // terms of the partial index in order
+    size_t runCount;
+    TermEntry *merged;          // merged terms of this thread's key range
+    size_t mergedCount;
+    Arena mergeArena;           // posting lists joined by the merge
+    FILE **runFiles;            // runs written when over the memory budget
+    int numRuns;
+    int runCapacity;
+    int spilled;                // wrote a run while parsing
+    TokenScanner scanner;
+} IndexWorker;
+
+// Parallel construction of the index, which owns the merged terms
+typedef struct IndexBuilder {
+    DocTable *docs;
+    IndexWorker *workers;
+    int numThreads;
+    size_t memoryBudget;        // bytes per thread, 0 for no limit
+    int positional;
+    int scalarTokenizer;        // parse with fscanf instead of the scanner
+    int spilled;                // the index is in run files, not in memory
+    char **splitters;           // first term of the key range of threads 1..N-1
+    pthread_barrier_t barrier;
+    TermEntry *terms;           // the whole index, in alphabetical order
+    size_t termCount;
+} IndexBuilder;
+
+// Writer of the binary index file. Postings are written as the terms
+// arrive; the term dictionary is kept until the file is closed.
+typedef struct {
+    FILE *file;
+    IndexFileHeader header;
+    uint32_t checksum;          // CRC-32 of everything after the header
+    uint64_t offset;            // bytes written so far
+    IndexTerm *terms;
+    uint32_t termCapacity;
+    char *words;
+    size_t wordBytes;
+    size_t wordCapacity;
+    unsigned char *buffer;      // varint encoding of one posting list
+    size_t bufferCapacity;
+} IndexWriter;
 
 // Function prototypes
-TreeNode *insertWord(TreeNode *root, const char *word, const char *filename);
-TreeNode *createTreeNode(const char *word, const char *filename);
-FileNode *createFileNode(const char *filename);
-void addFilename(FileNode **head, const char *filename);
+void *arenaAlloc(Arena *arena, size_t size);
+char *arenaStrdup(Arena *arena, const char *string);
+void freeArena(Arena *arena);
+void initDocTable(DocTable *docs);
+uint32_t addDocument(DocTable *docs, const char *name);
+void freeDocTable(DocTable *docs);
+void initInvertedIndex(InvertedIndex *index, int positional);
+void initTermTable(TermTable *table, size_t capacity);
+unsigned long hashWord(const char *word);
+TermEntry *findTerm(TermTable *table, const char *word, unsigned long hash);
+void growTermTable(TermTable *table);
+void insertWord(InvertedIndex *index, const char *word, uint32_t docId, uint32_t position);
+void appendPostingValue(InvertedIndex *index, PostingList *list, uint32_t value);
+void addPosting(InvertedIndex *index, PostingList *list, uint32_t docId, uint32_t position);
+uint32_t recordLength(const uint32_t *record, int positional);
+int compareDocOrder(const void *a, const void *b);
+int compareDocIds(const void *a, const void *b);
+int compareRecordKeys(const void *a, const void *b);
+uint32_t *renumberDocuments(DocTable *docs);
+void renumberPostings(PostingList *list, const uint32_t *newId, int positional);
+void renumberTerms(TermEntry *terms, size_t count, const uint32_t *newId, int positional);
 void normalizeWord(char *word);
-void printInvertedIndex(TreeNode *root, FILE *outputFile);
-void freeTree(TreeNode *root);
-void parseFile(const char *filename, TreeNode **root);
+int compareTermEntries(const void *a, const void *b);
+TermEntry **sortTerms(TermTable *table, size_t *count);
+void printTerm(DocTable *docs, const char *word, PostingList *list, int positional,
+               FILE *outputFile);
+void printInvertedIndex(DocTable *docs, TermEntry *terms, size_t count, int positional,
+                        FILE *outputFile, IndexWriter *binary);
+void freeInvertedIndex(InvertedIndex *index);
+size_t indexBytes(InvertedIndex *index);
+void flushRun(IndexWorker *worker);
+int loadDocument(TokenScanner *scanner, const char *path);
+void classifyBytes(TokenScanner *scanner);
+size_t findBit(const uint64_t *mask, size_t words, size_t from, int value);
+uint64_t upperBits(TokenScanner *scanner, size_t start, size_t count);
+int isMarkup(TokenScanner *scanner, size_t start, size_t length);
+char *nextToken(TokenScanner *scanner, uint32_t *position);
+void freeTokenScanner(TokenScanner *scanner);
+void parseFile(const char *filename, uint32_t docId, InvertedIndex *index,
+               TokenScanner *scanner);
+void parseFileScalar(const char *filename, uint32_t docId, InvertedIndex *index);
+void partitionDocuments(IndexBuilder *builder);
+void *runIndexWorker(void *arg);
+int compareWords(const void *a, const void *b);
+void chooseSplitters(IndexBuilder *builder);
+size_t lowerBound(TermEntry **run, size_t count, const char *word);
+int cursorLess(void *context, int a, int b);
+void siftDown(int *heap, int size, int i, int (*less)(void *, int, int), void *context);
+void mergeRuns(IndexWorker *worker);
+int readRunTerm(RunReader *reader);
+int readerLess(void *context, int a, int b);
+void mergeRunFiles(IndexBuilder *builder, DocTable *docs, const uint32_t *newId,
+                   FILE *outputFile, IndexWriter *binary);
+void writeIndexBytes(IndexWriter *writer, const void *data, size_t length);
+void padIndexWriter(IndexWriter *writer);
+void openIndexWriter(IndexWriter *writer, const char *path, DocTable *docs, int positional);
+size_t encodeVarint(unsigned char *out, uint64_t value);
+void writeIndexTerm(IndexWriter *writer, const char *word, PostingList *list);
+void closeIndexWriter(IndexWriter *writer);
+void buildIndex(IndexBuilder *builder, DocTable *docs, int numThreads, size_t memoryBudget,
+                int positional, int scalarTokenizer);
+void freeIndexBuilder(IndexBuilder *builder);
+
+int main(int argc, char **argv) {
+    int numThreads = 1;
+    long budgetMegabytes = 0;
+    int writeBinary = 0;
+    int positional = 0;
+    int scalarTokenizer = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            numThreads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--memory-budget") == 0 && i + 1 < argc) {
+            budgetMegabytes = atol(argv[++i]);
+            if (budgetMegabytes <= 0) {
+                fprintf(stderr, "Memory budget must be at least 1 MB\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--binary") == 0) {
+            writeBinary = 1;
+        } else if (strcmp(argv[i], "--positions") == 0) {
+            writeBinary = 1;
+            positional = 1;
+        } else if (strcmp(argv[i], "--scalar-tokenizer") == 0) {
+            scalarTokenizer = 1;
+        } else {
+            fprintf(stderr, "Usage: %s [--threads N] [--memory-budget MB] [--binary] "
+                    "[--positions] [--scalar-tokenizer]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (numThreads < 1) {
+        fprintf(stderr, "Number of threads must be at least 1\n");
+        return 1;
+    }
+    size_t memoryBudget = (size_t)budgetMegabytes * 1024 * 1024 / numThreads;
 
-int main() {
     // Open collection.txt
     FILE *collectionFile = fopen("collection.txt", "r");
     if (!collectionFile) {
@@ -53,34 +308,264 @@ int main() {
         return 1;
     }
 
-    TreeNode *root = NULL;
+    DocTable docs;
+    initDocTable(&docs);
     char filename[MAX_FILENAME_LENGTH];
 
     // Read filenames from collection.txt
     while (fscanf(collectionFile, "%s", filename) != EOF) {
-        printf("Processing file: %s\n", filename);
-        parseFile(filename, &root);
+        addDocument(&docs, filename);
     }
 
     fclose(collectionFile);
 
+    IndexBuilder builder;
+    buildIndex(&builder, &docs, numThreads, memoryBudget, positional, scalarTokenizer);
+
     // Write inverted index to a file
     FILE *outputFile = fopen("invertedIndex.txt", "w");
     if (!outputFile) {
         perror("Error opening invertedIndex.txt");
-        freeTree(root);
+        freeIndexBuilder(&builder);
+        freeDocTable(&docs);
         return 1;
     }
 
-    printInvertedIndex(root, outputFile);
+    uint32_t *newId = renumberDocuments(&docs);
+    IndexWriter writer;
+    if (writeBinary) {
+        openIndexWriter(&writer, "invertedIndex.bin", &docs, positional);
+    }
+    if (builder.spilled) {
+        mergeRunFiles(&builder, &docs, newId, outputFile, writeBinary ? &writer : NULL);
+    } else {
+        renumberTerms(builder.terms, builder.termCount, newId, positional);
+        printInvertedIndex(&docs, builder.terms, builder.termCount, positional, outputFile,
+                           writeBinary ? &writer : NULL);
+    }
     fclose(outputFile);
+    if (writeBinary) {
+        closeIndexWriter(&writer);
+    }
+    free(newId);
+
+    freeIndexBuilder(&builder);
+    freeDocTable(&docs);
+    return 0;
+}
+
+// Function to read a whole document into the scanner and classify its
+// bytes, returning 0 if it cannot be opened
+int loadDocument(TokenScanner *scanner, const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        return 0;
+    }
+
+    scanner->length = 0;
+    for (;;) {
+        // Keep a byte after the text for the NUL of its last word
+        if (scanner->capacity - scanner->length < INITIAL_TEXT_CAPACITY / 4) {
+            size_t capacity = scanner->capacity ? scanner->capacity * 2 : INITIAL_TEXT_CAPACITY;
+            char *text = realloc(scanner->text, capacity);
+            if (!text) {
+                perror("Error allocating memory for document text");
+                exit(1);
+            }
+            scanner->text = text;
+            scanner->capacity = capacity;
+        }
+        size_t read = fread(scanner->text + scanner->length, 1,
+                            scanner->capacity - scanner->length - 1, file);
+        if (read == 0) {
+            break;
+        }
+        scanner->length += read;
+    }
+    if (ferror(file)) {
+        fprintf(stderr, "Error reading input file: %s\n", path);
+    }
+    fclose(file);
+
+    classifyBytes(scanner);
+    scanner->next = 0;
+    scanner->position = 0;
+    return 1;
+}
+
+// Function to fill the whitespace and uppercase masks of the text and
+// lowercase it, 16 bytes at a time where SSE2 is available
+void classifyBytes(TokenScanner *scanner) {
+    // One spare word so that a whitespace bit always follows the text
+    size_t words = scanner->length / 64 + 2;
+    if (words > scanner->maskCapacity) {
+        uint64_t *space = realloc(scanner->space, words * sizeof(uint64_t));
+        uint64_t *upper = space ? realloc(scanner->upper, words * sizeof(uint64_t)) : NULL;
+        if (!space || !upper) {
+            perror("Error allocating memory for token masks");
+            exit(1);
+        }
+        scanner->space = space;
+        scanner->upper = upper;
+        scanner->maskCapacity = words;
+    }
+    scanner->maskWords = words;
+    memset(scanner->space, 0, words * sizeof(uint64_t));
+    memset(scanner->upper, 0, words * sizeof(uint64_t));
+
+    unsigned char *text = (unsigned char *)scanner->text;
+    size_t length = scanner->length;
+    size_t i = 0;
+#ifdef __SSE2__
+    // Bytes from 0x80 up are negative to the signed compares, so they are
+    // neither whitespace nor uppercase, as for isspace and isupper
+    const __m128i blank = _mm_set1_epi8(' ');
+    const __m128i belowTab = _mm_set1_epi8('\t' - 1);
+    const __m128i aboveReturn = _mm_set1_epi8('\r' + 1);
+    const __m128i belowA = _mm_set1_epi8('A' - 1);
+    const __m128i aboveZ = _mm_set1_epi8('Z' + 1);
+    const __m128i caseBit = _mm_set1_epi8(0x20);
+    for (; i + 16 <= length; i += 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i *)(text + i));
+        __m128i isSpace = _mm_or_si128(_mm_cmpeq_epi8(bytes, blank),
+                                       _mm_and_si128(_mm_cmpgt_epi8(bytes, belowTab),
+                                                     _mm_cmplt_epi8(bytes, aboveReturn)));
+        __m128i isUpper = _mm_and_si128(_mm_cmpgt_epi8(bytes, belowA),
+                                        _mm_cmplt_epi8(bytes, aboveZ));
+        _mm_storeu_si128((__m128i *)(text + i),
+                         _mm_or_si128(bytes, _mm_and_si128(isUpper, caseBit)));
+        scanner->space[i / 64] |= (uint64_t)(uint16_t)_mm_movemask_epi8(isSpace) << (i % 64);
+        scanner->upper[i / 64] |= (uint64_t)(uint16_t)_mm_movemask_epi8(isUpper) << (i % 64);
+    }
+#endif
+    for (; i < length; i++) {
+        if (text[i] == ' ' || (text[i] >= '\t' && text[i] <= '\r')) {
+            scanner->space[i / 64] |= 1ULL << (i % 64);
+        } else if (text[i] >= 'A' && text[i] <= 'Z') {
+            scanner->upper[i / 64] |= 1ULL << (i % 64);
+            text[i] |= 0x20;
+        }
+    }
+
+    scanner->space[length / 64] |= ~0ULL << (length % 64);
+    for (size_t w = length / 64 + 1; w < words; w++) {
+        scanner->space[w] = ~0ULL;
+    }
+}
+
+// Function to find the first bit at or after from that is set (value 1) or
+// clear (value 0), or words * 64 if there is none
+size_t findBit(const uint64_t *mask, size_t words, size_t from, int value) {
+    size_t w = from / 64;
+    if (w >= words) {
+        return words * 64;
+    }
+    uint64_t bits = (value ? mask[w] : ~mask[w]) & (~0ULL << (from % 64));
+    while (bits == 0) {
+        if (++w == words) {
+            return words * 64;
+        }
+        bits = value ? mask[w] : ~mask[w];
+    }
+    return w * 64 + __builtin_ctzll(bits);
+}
+
+// Function to get the uppercase bits of count (at most 64) bytes from start
+uint64_t upperBits(TokenScanner *scanner, size_t start, size_t count) {
+    size_t w = start / 64;
+    size_t shift = start % 64;
+    uint64_t bits = scanner->upper[w] >> shift;
+    if (shift > 0 && w + 1 < scanner->maskWords) {
+        bits |= scanner->upper[w + 1] << (64 - shift);
+    }
+    return count < 64 ? bits & ((1ULL << count) - 1) : bits;
+}
 
-    freeTree(root);
+// Function to check whether the word of length bytes at start was metadata
+// ("#start...", "#end...", "Section-1", "Section-2") or a filename ("url"
+// and a digit) before it was lowercased
+int isMarkup(TokenScanner *scanner, size_t start, size_t length) {
+    const char *word = scanner->text + start;
+    uint64_t upper = upperBits(scanner, start, length < 9 ? length : 9);
+    if (length >= 6 && memcmp(word, "#start", 6) == 0 && (upper & 0x3F) == 0) {
+        return 1;
+    }
+    if (length >= 4 && memcmp(word, "#end", 4) == 0 && (upper & 0xF) == 0) {
+        return 1;
+    }
+    if (length == 9 && memcmp(word, "section-", 8) == 0 && (word[8] == '1' || word[8] == '2') &&
+        upper == 1) {
+        return 1;
+    }
+    if (length >= 4 && memcmp(word, "url", 3) == 0 && (upper & 0x7) == 0 &&
+        isdigit((unsigned char)word[3])) {
+        return 1;
+    }
     return 0;
 }
 
+// Function to cut the next word to index out of the text: it is normalized
+// and NUL-terminated in place, and its position is stored. Returns NULL at
+// the end of the text.
+char *nextToken(TokenScanner *scanner, uint32_t *position) {
+    for (;;) {
+        size_t start = findBit(scanner->space, scanner->maskWords, scanner->next, 0);
+        if (start >= scanner->length) {
+            scanner->next = scanner->length;
+            return NULL;
+        }
+        size_t end = findBit(scanner->space, scanner->maskWords, start, 1);
+        scanner->next = end + 1;
+        scanner->position++;
+
+        // The byte after the word is whitespace or the spare byte at the end
+        char *word = scanner->text + start;
+        word[end - start] = '\0';
+        size_t length = strlen(word);
+        if (isMarkup(scanner, start, length)) {
+            continue;
+        }
+
+        // Remove trailing punctuation; a word must start with a letter
+        while (length > 0 && strchr(".,:;?*", word[length - 1])) {
+            length--;
+        }
+        word[length] = '\0';
+        if (length == 0 || word[0] < 'a' || word[0] > 'z') {
+            continue;
+        }
+        *position = scanner->position;
+        return word;
+    }
+}
+
+// Function to free the buffers of a token scanner
+void freeTokenScanner(TokenScanner *scanner) {
+    free(scanner->text);
+    free(scanner->space);
+    free(scanner->upper);
+}
+
 // Function to parse a file and add its words to the inverted index
-void parseFile(const char *filename, TreeNode **root) {
+void parseFile(const char *filename, uint32_t docId, InvertedIndex *index,
+               TokenScanner *scanner) {
+    char fullFilename[MAX_FILENAME_LENGTH + 5];
+    snprintf(fullFilename, sizeof(fullFilename), "%s.txt", filename);
+
+    if (!loadDocument(scanner, fullFilename)) {
+        fprintf(stderr, "Error opening input file: %s\n", fullFilename);
+        return;
+    }
+
+    char *word;
+    uint32_t position;
+    while ((word = nextToken(scanner, &position)) != NULL) {
+        insertWord(index, word, docId, position);
+    }
+}
+
+// Function to parse a file with fscanf, one word at a time
+void parseFileScalar(const char *filename, uint32_t docId, InvertedIndex *index) {
     char fullFilename[MAX_FILENAME_LENGTH + 5];
     snprintf(fullFilename, sizeof(fullFilename), "%s.txt", filename);
 
@@ -91,7 +576,10 @@ void parseFile(const char *filename, TreeNode **root) {
     }
 
     char word[MAX_WORD_LENGTH];
+    uint32_t position = 0;
     while (fscanf(file, "%s", word) != EOF) {
+        position++;
+
         // Skip metadata like "#start", "#end", "section-1", "section-2"
         if (strncmp(word, "#start", 6) == 0 || strncmp(word, "#end", 4) == 0 ||
             strcmp(word, "Section-1") == 0 || strcmp(word, "Section-2") == 0) {
@@ -106,7 +594,7 @@ void parseFile(const char *filename, TreeNode **root) {
         // Normalize the word and add to the inverted index if valid
         normalizeWord(word);
         if (strlen(word) > 0) {
-            *root = insertWord(*root, word, filename);
+            insertWord(index, word, docId, position);
         }
     }
 
@@ -138,120 +626,998 @@ void normalizeWord(char *word) {
 }
 
 
-// Function to insert a word into the binary search tree
-TreeNode *insertWord(TreeNode *root, const char *word, const char *filename) {
-    if (root == NULL) {
-        return createTreeNode(word, filename);
+// Function to allocate size bytes from the arena, 8-byte aligned
+void *arenaAlloc(Arena *arena, size_t size) {
+    size = (size + 7) & ~(size_t)7;
+    ArenaBlock *block = arena->head;
+    if (block == NULL || block->size - block->used < size) {
+        size_t blockSize = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+        block = malloc(sizeof(ArenaBlock) + blockSize);
+        if (!block) {
+            perror("Error allocating arena block");
+            exit(1);
+        }
+        block->next = arena->head;
+        block->used = 0;
+        block->size = blockSize;
+        arena->head = block;
     }
+    void *memory = block->data + block->used;
+    block->used += size;
+    arena->bytes += size;
+    return memory;
+}
 
-    int cmp = strcmp(word, root->word);
-    if (cmp < 0) {
-        root->left = insertWord(root->left, word, filename);
-    } else if (cmp > 0) {
-        root->right = insertWord(root->right, word, filename);
-    } else {
-        addFilename(&(root->fileList), filename);
+// Function to copy a string into the arena
+char *arenaStrdup(Arena *arena, const char *string) {
+    size_t length = strlen(string) + 1;
+    char *copy = arenaAlloc(arena, length);
+    memcpy(copy, string, length);
+    return copy;
+}
+
+// Function to free every block of the arena
+void freeArena(Arena *arena) {
+    ArenaBlock *block = arena->head;
+    while (block != NULL) {
+        ArenaBlock *next = block->next;
+        free(block);
+        block = next;
     }
+    arena->head = NULL;
+    arena->bytes = 0;
+}
 
-    return root;
+// Function to create an empty document table
+void initDocTable(DocTable *docs) {
+    docs->names = malloc(INITIAL_DOC_CAPACITY * sizeof(char *));
+    if (!docs->names) {
+        perror("Error allocating memory for document table");
+        exit(1);
+    }
+    docs->count = 0;
+    docs->capacity = INITIAL_DOC_CAPACITY;
+    docs->arena.head = NULL;
+    docs->arena.bytes = 0;
 }
 
-// Function to create a new tree node
-TreeNode *createTreeNode(const char *word, const char *filename) {
-    TreeNode *newNode = malloc(sizeof(TreeNode));
-    if (!newNode) {
-        perror("Error allocating memory for tree node");
+// Function to add a document to the document table and return its id
+uint32_t addDocument(DocTable *docs, const char *name) {
+    if (docs->count == UINT32_MAX) {
+        fprintf(stderr, "Too many documents\n");
         exit(1);
     }
+    if (docs->count == docs->capacity) {
+        uint32_t capacity = docs->capacity > UINT32_MAX / 2 ? UINT32_MAX : docs->capacity * 2;
+        char **names = realloc(docs->names, (size_t)capacity * sizeof(char *));
+        if (!names) {
+            perror("Error allocating memory for document table");
+            exit(1);
+        }
+        docs->names = names;
+        docs->capacity = capacity;
+    }
+    docs->names[docs->count] = arenaStrdup(&docs->arena, name);
+    return docs->count++;
+}
 
-    strcpy(newNode->word, word);
-    newNode->fileList = createFileNode(filename);
-    newNode->left = NULL;
-    newNode->right = NULL;
-    return newNode;
+// Function to free the document table
+void freeDocTable(DocTable *docs) {
+    free(docs->names);
+    freeArena(&docs->arena);
 }
 
-// Function to create a new file node
-FileNode *createFileNode(const char *filename) {
-    FileNode *newNode = malloc(sizeof(FileNode));
-    if (!newNode) {
-        perror("Error allocating memory for file node");
+// Function to create an empty index
+void initInvertedIndex(InvertedIndex *index, int positional) {
+    initTermTable(&index->terms, INITIAL_TABLE_SIZE);
+    index->positional = positional;
+    index->arena.head = NULL;
+    index->arena.bytes = 0;
+}
+
+// Function to create an empty term table with capacity slots
+void initTermTable(TermTable *table, size_t capacity) {
+    table->entries = calloc(capacity, sizeof(TermEntry));
+    if (!table->entries) {
+        perror("Error allocating memory for term table");
         exit(1);
     }
+    table->capacity = capacity;
+    table->count = 0;
+}
 
-    strcpy(newNode->filename, filename);
-    newNode->next = NULL;
-    return newNode;
+// Function to hash a word (FNV-1a)
+unsigned long hashWord(const char *word) {
+    unsigned long hash = 14695981039346656037UL;
+    for (const unsigned char *c = (const unsigned char *)word; *c; c++) {
+        hash = (hash ^ *c) * 1099511628211UL;
+    }
+    return hash;
 }
 
-// Function to add a filename to the file list
-// Function to add a filename to the file list in sorted order
-void addFilename(FileNode **head, const char *filename) {
-    FileNode *current = *head;
-    FileNode *prev = NULL;
+// Function to find the slot of a word: the entry holding it, or the empty
+// slot where it belongs
+TermEntry *findTerm(TermTable *table, const char *word, unsigned long hash) {
+    size_t mask = table->capacity - 1;
+    size_t slot = hash & mask;
+    while (table->entries[slot].word != NULL &&
+           (table->entries[slot].hash != hash || strcmp(table->entries[slot].word, word) != 0)) {
+        slot = (slot + 1) & mask;
+    }
+    return &table->entries[slot];
+}
 
-    // Create a new file node
-    FileNode *newNode = createFileNode(filename);
+// Function to double the capacity of the table, rehashing every term
+void growTermTable(TermTable *table) {
+    TermEntry *old = table->entries;
+    size_t oldCapacity = table->capacity;
 
-    // Find the correct position for insertion (sorted order)
-    while (current != NULL && strcmp(current->filename, filename) < 0) {
-        prev = current;
-        current = current->next;
+    initTermTable(table, oldCapacity * 2);
+    for (size_t i = 0; i < oldCapacity; i++) {
+        if (old[i].word != NULL) {
+            *findTerm(table, old[i].word, old[i].hash) = old[i];
+            table->count++;
+        }
     }
+    free(old);
+}
 
-    // Check if the filename already exists
-    if (current != NULL && strcmp(current->filename, filename) == 0) {
-        free(newNode); // Filename already exists, no need to add it again
+// Function to insert a word into the term table, interning it on first
+// sight
+void insertWord(InvertedIndex *index, const char *word, uint32_t docId, uint32_t position) {
+    TermTable *table = &index->terms;
+    unsigned long hash = hashWord(word);
+    TermEntry *entry = findTerm(table, word, hash);
+    if (entry->word != NULL) {
+        addPosting(index, &entry->postings, docId, position);
         return;
     }
 
-    // Insert the new file node at the correct position
-    if (prev == NULL) {
-        // Insert at the head
-        newNode->next = *head;
-        *head = newNode;
-    } else {
-        // Insert in the middle or at the end
-        newNode->next = current;
-        prev->next = newNode;
+    if (2 * (table->count + 1) > table->capacity) {
+        growTermTable(table);
+        entry = findTerm(table, word, hash);
     }
+    entry->word = arenaStrdup(&index->arena, word);
+    entry->hash = hash;
+    memset(&entry->postings, 0, sizeof(PostingList));
+    addPosting(index, &entry->postings, docId, position);
+    table->count++;
 }
 
+// Function to append a value to a posting list. A full array moves to twice
+// the space in the arena.
+void appendPostingValue(InvertedIndex *index, PostingList *list, uint32_t value) {
+    if (list->count == list->capacity) {
+        uint32_t capacity = list->capacity > 0 ? list->capacity * 2 : INITIAL_POSTING_CAPACITY;
+        uint32_t *values = arenaAlloc(&index->arena, (size_t)capacity * sizeof(uint32_t));
+        if (list->count > 0) {
+            memcpy(values, list->values, list->count * sizeof(uint32_t));
+        }
+        list->values = values;
+        list->capacity = capacity;
+    }
+    list->values[list->count++] = value;
+}
 
-// Function to print the inverted index to a file
-void printInvertedIndex(TreeNode *root, FILE *outputFile) {
-    if (root == NULL) {
+// Function to add an occurrence of a term to its posting list. Documents are
+// parsed one at a time, so a repeated term only has to be checked against
+// the last document.
+void addPosting(InvertedIndex *index, PostingList *list, uint32_t docId, uint32_t position) {
+    if (list->docCount > 0 && list->values[list->last] == docId) {
+        if (index->positional) {
+            appendPostingValue(index, list, position);
+            list->values[list->last + 1]++;
+        }
         return;
     }
+    list->last = list->count;
+    list->docCount++;
+    appendPostingValue(index, list, docId);
+    if (index->positional) {
+        appendPostingValue(index, list, 1);
+        appendPostingValue(index, list, position);
+    }
+}
 
-    printInvertedIndex(root->left, outputFile);
+// Function to get the number of values in the record of one document
+uint32_t recordLength(const uint32_t *record, int positional) {
+    return positional ? 2 + record[1] : 1;
+}
 
-    fprintf(outputFile, "%s", root->word);
-    FileNode *current = root->fileList;
-    while (current != NULL) {
-        fprintf(outputFile, " %s", current->filename);
-        current = current->next;
+int compareDocOrder(const void *a, const void *b) {
+    const DocOrder *docA = a;
+    const DocOrder *docB = b;
+    int order = strcmp(docA->name, docB->name);
+    if (order != 0) {
+        return order;
     }
-    fprintf(outputFile, "\n");
+    return (docA->docId > docB->docId) - (docA->docId < docB->docId);
+}
 
-    printInvertedIndex(root->right, outputFile);
+int compareDocIds(const void *a, const void *b) {
+    uint32_t idA = *(const uint32_t *)a;
+    uint32_t idB = *(const uint32_t *)b;
+    return (idA > idB) - (idA < idB);
 }
 
-// Function to free the tree
-void freeTree(TreeNode *root) {
-    if (root == NULL) {
+// Function to sort the document table by filename and return the new id of
+// every old id. A file listed more than once in collection.txt keeps a
+// single id.
+uint32_t *renumberDocuments(DocTable *docs) {
+    uint32_t n = docs->count;
+    DocOrder *order = malloc((n > 0 ? n : 1) * sizeof(DocOrder));
+    uint32_t *newId = malloc((n > 0 ? n : 1) * sizeof(uint32_t));
+    if (!order || !newId) {
+        perror("Error allocating memory for document order");
+        exit(1);
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        order[i].name = docs->names[i];
+        order[i].docId = i;
+    }
+    qsort(order, n, sizeof(DocOrder), compareDocOrder);
+
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        if (count == 0 || strcmp(docs->names[count - 1], order[i].name) != 0) {
+            docs->names[count++] = order[i].name;
+        }
+        newId[order[i].docId] = count - 1;
+    }
+    docs->count = count;
+
+    free(order);
+    return newId;
+}
+
+int compareRecordKeys(const void *a, const void *b) {
+    uint64_t keyA = *(const uint64_t *)a;
+    uint64_t keyB = *(const uint64_t *)b;
+    return (keyA > keyB) - (keyA < keyB);
+}
+
+// Function to renumber a posting list, sorting it only if it comes out of
+// order. Of several records of one document, the first is kept.
+void renumberPostings(PostingList *list, const uint32_t *newId, int positional) {
+    int sorted = 1;
+    for (uint32_t k = 0, previous = 0; k < list->count;
+         k += recordLength(list->values + k, positional)) {
+        list->values[k] = newId[list->values[k]];
+        if (k > 0 && list->values[k] <= previous) {
+            sorted = 0;
+        }
+        previous = list->values[k];
+    }
+    if (sorted) {
+        return;
+    }
+    if (!positional) {
+        qsort(list->values, list->count, sizeof(uint32_t), compareDocIds);
+        uint32_t unique = 0;
+        for (uint32_t k = 0; k < list->count; k++) {
+            if (unique == 0 || list->values[k] != list->values[unique - 1]) {
+                list->values[unique++] = list->values[k];
+            }
+        }
+        list->count = unique;
+        list->docCount = unique;
         return;
     }
 
-    freeTree(root->left);
-    freeTree(root->right);
+    // Sort the records by document id, then by where they start
+    uint64_t *keys = malloc(list->docCount * sizeof(uint64_t));
+    uint32_t *values = malloc(list->count * sizeof(uint32_t));
+    if (!keys || !values) {
+        perror("Error allocating memory for posting order");
+        exit(1);
+    }
+    uint32_t numRecords = 0;
+    for (uint32_t k = 0; k < list->count; k += recordLength(list->values + k, positional)) {
+        keys[numRecords++] = (uint64_t)list->values[k] << 32 | k;
+    }
+    qsort(keys, numRecords, sizeof(uint64_t), compareRecordKeys);
+    uint32_t count = 0;
+    list->docCount = 0;
+    for (uint32_t r = 0; r < numRecords; r++) {
+        if (r > 0 && keys[r] >> 32 == keys[r - 1] >> 32) {
+            continue;
+        }
+        const uint32_t *record = list->values + (uint32_t)keys[r];
+        uint32_t length = recordLength(record, positional);
+        memcpy(values + count, record, length * sizeof(uint32_t));
+        count += length;
+        list->docCount++;
+    }
+    memcpy(list->values, values, count * sizeof(uint32_t));
+    list->count = count;
+    free(keys);
+    free(values);
+}
+
+// Function to renumber the posting lists of every term, so that they can
+// be written in order of their ids
+void renumberTerms(TermEntry *terms, size_t termCount, const uint32_t *newId, int positional) {
+    for (size_t t = 0; t < termCount; t++) {
+        renumberPostings(&terms[t].postings, newId, positional);
+    }
+}
+
+int compareTermEntries(const void *a, const void *b) {
+    const TermEntry *termA = *(const TermEntry * const *)a;
+    const TermEntry *termB = *(const TermEntry * const *)b;
+    return strcmp(termA->word, termB->word);
+}
+
+// Function to collect the terms of a table in alphabetical order
+TermEntry **sortTerms(TermTable *table, size_t *count) {
+    TermEntry **terms = malloc((table->count > 0 ? table->count : 1) * sizeof(TermEntry *));
+    if (!terms) {
+        perror("Error allocating memory for sorted terms");
+        exit(1);
+    }
+    *count = 0;
+    for (size_t i = 0; i < table->capacity; i++) {
+        if (table->entries[i].word != NULL) {
+            terms[(*count)++] = &table->entries[i];
+        }
+    }
+    qsort(terms, *count, sizeof(TermEntry *), compareTermEntries);
+    return terms;
+}
+
+// Function to print one term of the inverted index with its documents
+void printTerm(DocTable *docs, const char *word, PostingList *list, int positional,
+               FILE *outputFile) {
+    fprintf(outputFile, "%s", word);
+    for (uint32_t k = 0; k < list->count; k += recordLength(list->values + k, positional)) {
+        fprintf(outputFile, " %s", docs->names[list->values[k]]);
+    }
+    fprintf(outputFile, "\n");
+}
 
-    FileNode *current = root->fileList;
-    while (current != NULL) {
-        FileNode *temp = current;
-        current = current->next;
-        free(temp);
+// Function to print the inverted index to a file, and to the binary index
+// if there is one
+void printInvertedIndex(DocTable *docs, TermEntry *terms, size_t count, int positional,
+                        FILE *outputFile, IndexWriter *binary) {
+    for (size_t k = 0; k < count; k++) {
+        printTerm(docs, terms[k].word, &terms[k].postings, positional, outputFile);
+        if (binary) {
+            writeIndexTerm(binary, terms[k].word, &terms[k].postings);
+        }
     }
+}
 
-    free(root);
+// Function to free the index
+void freeInvertedIndex(InvertedIndex *index) {
+    free(index->terms.entries);
+    freeArena(&index->arena);
+}
+
+// Function to count the memory held by an index
+size_t indexBytes(InvertedIndex *index) {
+    return index->arena.bytes + index->terms.capacity * sizeof(TermEntry);
+}
+
+// Function to write the partial index of a thread to a temporary file as a
+// sorted run and empty it. A run is a sequence of terms, each a 32-bit
+// length, the characters of the term, a 32-bit count of posting values, the
+// 32-bit number of documents and the values.
+void flushRun(IndexWorker *worker) {
+    size_t count;
+    TermEntry **terms = sortTerms(&worker->partial.terms, &count);
+    FILE *file = tmpfile();
+    if (!file) {
+        perror("Error creating run file");
+        exit(1);
+    }
+    for (size_t k = 0; k < count; k++) {
+        uint32_t length = strlen(terms[k]->word);
+        fwrite(&length, sizeof(length), 1, file);
+        fwrite(terms[k]->word, 1, length, file);
+        fwrite(&terms[k]->postings.count, sizeof(uint32_t), 1, file);
+        fwrite(&terms[k]->postings.docCount, sizeof(uint32_t), 1, file);
+        fwrite(terms[k]->postings.values, sizeof(uint32_t), terms[k]->postings.count, file);
+    }
+    if (fflush(file) != 0 || ferror(file)) {
+        perror("Error writing run file");
+        exit(1);
+    }
+    rewind(file);
+    free(terms);
+
+    if (worker->numRuns == worker->runCapacity) {
+        worker->runCapacity = worker->runCapacity > 0 ? worker->runCapacity * 2 : 4;
+        worker->runFiles = realloc(worker->runFiles, worker->runCapacity * sizeof(FILE *));
+        if (!worker->runFiles) {
+            perror("Error allocating memory for run files");
+            exit(1);
+        }
+    }
+    worker->runFiles[worker->numRuns++] = file;
+
+    freeInvertedIndex(&worker->partial);
+    initInvertedIndex(&worker->partial, worker->builder->positional);
+}
+
+// Function to cut the document table into one slice per thread, each with
+// about the same number of bytes to parse
+void partitionDocuments(IndexBuilder *builder) {
+    DocTable *docs = builder->docs;
+    long long *bytes = malloc((docs->count > 0 ? docs->count : 1) * sizeof(long long));
+    if (!bytes) {
+        perror("Error allocating memory for document sizes");
+        exit(1);
+    }
+    long long total = 0;
+    for (uint32_t doc = 0; doc < docs->count; doc++) {
+        char fullFilename[MAX_FILENAME_LENGTH + 5];
+        snprintf(fullFilename, sizeof(fullFilename), "%s.txt", docs->names[doc]);
+        struct stat st;
+        bytes[doc] = stat(fullFilename, &st) == 0 ? (long long)st.st_size : 0;
+        total += bytes[doc];
+    }
+
+    uint32_t doc = 0;
+    long long seen = 0;
+    for (int t = 0; t < builder->numThreads; t++) {
+        long long target = total / builder->numThreads * (t + 1) +
+                           total % builder->numThreads * (t + 1) / builder->numThreads;
+        builder->workers[t].firstDoc = doc;
+        while (doc < docs->count && (t == builder->numThreads - 1 || seen < target)) {
+            seen += bytes[doc++];
+        }
+        builder->workers[t].lastDoc = doc;
+    }
+    free(bytes);
+}
+
+// Function run by every indexing thread: parse its slice, sort its terms,
+// then merge its key range of all the partial indexes
+void *runIndexWorker(void *arg) {
+    IndexWorker *worker = arg;
+    IndexBuilder *builder = worker->builder;
+
+    initInvertedIndex(&worker->partial, builder->positional);
+    for (uint32_t doc = worker->firstDoc; doc < worker->lastDoc; doc++) {
+        printf("Processing file: %s\n", builder->docs->names[doc]);
+        if (builder->scalarTokenizer) {
+            parseFileScalar(builder->docs->names[doc], doc, &worker->partial);
+        } else {
+            parseFile(builder->docs->names[doc], doc, &worker->partial, &worker->scanner);
+        }
+        if (builder->memoryBudget > 0 && indexBytes(&worker->partial) > builder->memoryBudget) {
+            flushRun(worker);
+        }
+    }
+    worker->spilled = worker->numRuns > 0;
+
+    // If any thread ran out of memory, the whole index is merged from runs
+    pthread_barrier_wait(&builder->barrier);
+    for (int t = 0; t < builder->numThreads; t++) {
+        if (builder->workers[t].spilled) {
+            if (worker->partial.terms.count > 0) {
+                flushRun(worker);
+            }
+            return NULL;
+        }
+    }
+
+    worker->run = sortTerms(&worker->partial.terms, &worker->runCount);
+    pthread_barrier_wait(&builder->barrier);
+    if (worker->id == 0) {
+        chooseSplitters(builder);
+    }
+    pthread_barrier_wait(&builder->barrier);
+
+    mergeRuns(worker);
+    return NULL;
+}
+
+int compareWords(const void *a, const void *b) {
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+// Function to split the terms into one key range per thread, using evenly
+// spaced samples of every partial index
+void chooseSplitters(IndexBuilder *builder) {
+    int k = builder->numThreads;
+    char **samples = malloc((size_t)k * k * sizeof(char *));
+    if (!samples) {
+        perror("Error allocating memory for merge samples");
+        exit(1);
+    }
+    size_t numSamples = 0;
+    for (int t = 0; t < k; t++) {
+        IndexWorker *worker = &builder->workers[t];
+        for (int s = 0; s < k && worker->runCount > 0; s++) {
+            samples[numSamples++] = worker->run[worker->runCount * s / k]->word;
+        }
+    }
+    qsort(samples, numSamples, sizeof(char *), compareWords);
+
+    // Without any terms every range is empty, whatever the splitters
+    for (int j = 1; j < k; j++) {
+        builder->splitters[j - 1] = numSamples > 0 ? samples[numSamples * j / k] : "";
+    }
+    free(samples);
+}
+
+// Function to find the first term of a sorted run that is not less than word
+size_t lowerBound(TermEntry **run, size_t count, const char *word) {
+    size_t lo = 0, hi = count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (strcmp(run[mid]->word, word) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// Function to order two merge cursors by their current term, then by thread
+// so that the posting lists of a term are joined in document order
+int cursorLess(void *context, int a, int b) {
+    MergeCursor *cursors = context;
+    int order = strcmp(cursors[a].run[cursors[a].pos]->word,
+                       cursors[b].run[cursors[b].pos]->word);
+    return order < 0 || (order == 0 && a < b);
+}
+
+// Function to restore a min-heap below position i, ordered by less
+void siftDown(int *heap, int size, int i, int (*less)(void *, int, int), void *context) {
+    while (2 * i + 1 < size) {
+        int child = 2 * i + 1;
+        if (child + 1 < size && less(context, heap[child + 1], heap[child])) {
+            child++;
+        }
+        if (!less(context, heap[child], heap[i])) {
+            break;
+        }
+        int temp = heap[i];
+        heap[i] = heap[child];
+        heap[child] = temp;
+        i = child;
+    }
+}
+
+// Function to merge this thread's key range of the sorted partial indexes.
+// Every thread parsed a contiguous slice of the documents, so the posting
+// lists of a term are joined in thread order.
+void mergeRuns(IndexWorker *worker) {
+    IndexBuilder *builder = worker->builder;
+    int k = builder->numThreads;
+    const char *low = worker->id > 0 ? builder->splitters[worker->id - 1] : NULL;
+    const char *high = worker->id < k - 1 ? builder->splitters[worker->id] : NULL;
+
+    MergeCursor *cursors = malloc(k * sizeof(MergeCursor));
+    int *heap = malloc(k * sizeof(int));
+    TermEntry **same = malloc(k * sizeof(TermEntry *));
+    if (!cursors || !heap || !same) {
+        perror("Error allocating memory for merge");
+        exit(1);
+    }
+    size_t total = 0;
+    int heapSize = 0;
+    for (int r = 0; r < k; r++) {
+        IndexWorker *source = &builder->workers[r];
+        cursors[r].run = source->run;
+        cursors[r].pos = low ? lowerBound(source->run, source->runCount, low) : 0;
+        cursors[r].end = high ? lowerBound(source->run, source->runCount, high) : source->runCount;
+        if (cursors[r].pos < cursors[r].end) {
+            total += cursors[r].end - cursors[r].pos;
+            heap[heapSize++] = r;
+        }
+    }
+    for (int i = heapSize / 2 - 1; i >= 0; i--) {
+        siftDown(heap, heapSize, i, cursorLess, cursors);
+    }
+
+    worker->merged = malloc((total > 0 ? total : 1) * sizeof(TermEntry));
+    if (!worker->merged) {
+        perror("Error allocating memory for merged terms");
+        exit(1);
+    }
+    worker->mergedCount = 0;
+    worker->mergeArena.head = NULL;
+    worker->mergeArena.bytes = 0;
+
+    while (heapSize > 0) {
+        // Take the term off every run that has it
+        const char *word = cursors[heap[0]].run[cursors[heap[0]].pos]->word;
+        int numSame = 0;
+        while (heapSize > 0 && strcmp(cursors[heap[0]].run[cursors[heap[0]].pos]->word, word) == 0) {
+            MergeCursor *cursor = &cursors[heap[0]];
+            same[numSame++] = cursor->run[cursor->pos++];
+            if (cursor->pos == cursor->end) {
+                heap[0] = heap[--heapSize];
+            }
+            siftDown(heap, heapSize, 0, cursorLess, cursors);
+        }
+
+        TermEntry *out = &worker->merged[worker->mergedCount++];
+        *out = *same[0];
+        if (numSame == 1) {
+            continue;
+        }
+        uint32_t count = 0;
+        for (int s = 0; s < numSame; s++) {
+            count += same[s]->postings.count;
+        }
+        out->postings.values = arenaAlloc(&worker->mergeArena, (size_t)count * sizeof(uint32_t));
+        out->postings.count = 0;
+        out->postings.capacity = count;
+        out->postings.docCount = 0;
+        for (int s = 0; s < numSame; s++) {
+            memcpy(out->postings.values + out->postings.count, same[s]->postings.values,
+                   same[s]->postings.count * sizeof(uint32_t));
+            out->postings.count += same[s]->postings.count;
+            out->postings.docCount += same[s]->postings.docCount;
+        }
+    }
+
+    free(cursors);
+    free(heap);
+    free(same);
+}
+
+// Function to read the next term of a run, returning 0 at the end of the run
+int readRunTerm(RunReader *reader) {
+    uint32_t length;
+    if (fread(&length, sizeof(length), 1, reader->file) != 1) {
+        if (ferror(reader->file)) {
+            perror("Error reading run file");
+            exit(1);
+        }
+        return 0;
+    }
+    if (length + 1 > reader->wordCapacity) {
+        reader->wordCapacity = length + 1;
+        reader->word = realloc(reader->word, reader->wordCapacity);
+        if (!reader->word) {
+            perror("Error allocating memory for run term");
+            exit(1);
+        }
+    }
+    if (fread(reader->word, 1, length, reader->file) != length ||
+        fread(&reader->count, sizeof(reader->count), 1, reader->file) != 1 ||
+        fread(&reader->docCount, sizeof(reader->docCount), 1, reader->file) != 1) {
+        fprintf(stderr, "Error reading run file: truncated term\n");
+        exit(1);
+    }
+    reader->word[length] = '\0';
+    return 1;
+}
+
+// Function to order two run readers by their current term, then by run so
+// that the posting lists of a term are joined in document order
+int readerLess(void *context, int a, int b) {
+    RunReader *readers = context;
+    int order = strcmp(readers[a].word, readers[b].word);
+    return order < 0 || (order == 0 && a < b);
+}
+
+// Function to merge the runs of every thread into the inverted index file,
+// holding one term of every run and the posting list of one term at a time
+void mergeRunFiles(IndexBuilder *builder, DocTable *docs, const uint32_t *newId,
+                   FILE *outputFile, IndexWriter *binary) {
+    int numRuns = 0;
+    for (int t = 0; t < builder->numThreads; t++) {
+        numRuns += builder->workers[t].numRuns;
+    }
+    RunReader *readers = calloc(numRuns > 0 ? numRuns : 1, sizeof(RunReader));
+    int *heap = malloc((numRuns > 0 ? numRuns : 1) * sizeof(int));
+    if (!readers || !heap) {
+        perror("Error allocating memory for run merge");
+        exit(1);
+    }
+    fprintf(stderr, "Merging %d runs\n", numRuns);
+    int heapSize = 0;
+    int r = 0;
+    for (int t = 0; t < builder->numThreads; t++) {
+        for (int k = 0; k < builder->workers[t].numRuns; k++, r++) {
+            readers[r].file = builder->workers[t].runFiles[k];
+            if (readRunTerm(&readers[r])) {
+                heap[heapSize++] = r;
+            }
+        }
+    }
+    for (int i = heapSize / 2 - 1; i >= 0; i--) {
+        siftDown(heap, heapSize, i, readerLess, readers);
+    }
+
+    char *word = NULL;
+    size_t wordCapacity = 0;
+    PostingList list;
+    memset(&list, 0, sizeof(list));
+    while (heapSize > 0) {
+        size_t length = strlen(readers[heap[0]].word) + 1;
+        if (length > wordCapacity) {
+            wordCapacity = length;
+            word = realloc(word, wordCapacity);
+            if (!word) {
+                perror("Error allocating memory for merged term");
+                exit(1);
+            }
+        }
+        memcpy(word, readers[heap[0]].word, length);
+
+        // Join the posting lists of the term from every run that has it
+        list.count = 0;
+        list.docCount = 0;
+        while (heapSize > 0 && strcmp(readers[heap[0]].word, word) == 0) {
+            RunReader *reader = &readers[heap[0]];
+            if (list.count + reader->count > list.capacity) {
+                list.capacity = list.count + reader->count;
+                list.values = realloc(list.values, (size_t)list.capacity * sizeof(uint32_t));
+                if (!list.values) {
+                    perror("Error allocating memory for merged postings");
+                    exit(1);
+                }
+            }
+            if (fread(list.values + list.count, sizeof(uint32_t), reader->count,
+                      reader->file) != reader->count) {
+                fprintf(stderr, "Error reading run file: truncated postings\n");
+                exit(1);
+            }
+            list.count += reader->count;
+            list.docCount += reader->docCount;
+            if (!readRunTerm(reader)) {
+                heap[0] = heap[--heapSize];
+            }
+            siftDown(heap, heapSize, 0, readerLess, readers);
+        }
+
+        renumberPostings(&list, newId, builder->positional);
+        printTerm(docs, word, &list, builder->positional, outputFile);
+        if (binary) {
+            writeIndexTerm(binary, word, &list);
+        }
+    }
+
+    for (r = 0; r < numRuns; r++) {
+        free(readers[r].word);
+    }
+    free(readers);
+    free(heap);
+    free(word);
+    free(list.values);
+}
+
+// Function to write bytes after the header of the binary index
+void writeIndexBytes(IndexWriter *writer, const void *data, size_t length) {
+    if (length > 0 && fwrite(data, 1, length, writer->file) != length) {
+        perror("Error writing invertedIndex.bin");
+        exit(1);
+    }
+    writer->checksum = indexChecksum(writer->checksum, data, length);
+    writer->offset += length;
+}
+
+// Function to pad the binary index to a multiple of 8 bytes
+void padIndexWriter(IndexWriter *writer) {
+    static const char zeros[8];
+    writeIndexBytes(writer, zeros, (8 - writer->offset % 8) % 8);
+}
+
+// Function to start a binary index with the document table, which must
+// already be in its final order
+void openIndexWriter(IndexWriter *writer, const char *path, DocTable *docs, int positional) {
+    memset(writer, 0, sizeof(IndexWriter));
+    writer->file = fopen(path, "wb");
+    if (!writer->file) {
+        perror("Error opening invertedIndex.bin");
+        exit(1);
+    }
+
+    // The header is written last, once the checksums are known
+    if (fwrite(&writer->header, sizeof(IndexFileHeader), 1, writer->file) != 1) {
+        perror("Error writing invertedIndex.bin");
+        exit(1);
+    }
+    writer->offset = sizeof(IndexFileHeader);
+    writer->header.numDocs = docs->count;
+    writer->header.flags = positional ? INDEX_FILE_POSITIONS : 0;
+
+    uint32_t nameOffset = 0;
+    for (uint32_t doc = 0; doc <= docs->count; doc++) {
+        writeIndexBytes(writer, &nameOffset, sizeof(nameOffset));
+        if (doc < docs->count) {
+            size_t length = strlen(docs->names[doc]) + 1;
+            if (length > UINT32_MAX - nameOffset) {
+                fprintf(stderr, "Document names too long for invertedIndex.bin\n");
+                exit(1);
+            }
+            nameOffset += length;
+        }
+    }
+    writer->header.namesOffset = writer->offset;
+    for (uint32_t doc = 0; doc < docs->count; doc++) {
+        writeIndexBytes(writer, docs->names[doc], strlen(docs->names[doc]) + 1);
+    }
+    padIndexWriter(writer);
+    writer->header.postingsOffset = writer->offset;
+}
+
+// Function to add the next term, in alphabetical order, to the binary index
+void writeIndexTerm(IndexWriter *writer, const char *word, PostingList *list) {
+    if (writer->header.numTerms == writer->termCapacity) {
+        writer->termCapacity = writer->termCapacity > 0 ? writer->termCapacity * 2 : 1024;
+        writer->terms = realloc(writer->terms, (size_t)writer->termCapacity * sizeof(IndexTerm));
+        if (!writer->terms) {
+            perror("Error allocating memory for term dictionary");
+            exit(1);
+        }
+    }
+    size_t length = strlen(word) + 1;
+    if (writer->wordBytes + length > UINT32_MAX) {
+        fprintf(stderr, "Terms too long for invertedIndex.bin\n");
+        exit(1);
+    }
+    if (writer->wordBytes + length > writer->wordCapacity) {
+        writer->wordCapacity = (writer->wordBytes + length) * 2;
+        writer->words = realloc(writer->words, writer->wordCapacity);
+        if (!writer->words) {
+            perror("Error allocating memory for term dictionary");
+            exit(1);
+        }
+    }
+    IndexTerm *term = &writer->terms[writer->header.numTerms++];
+    term->postingsOffset = writer->offset - writer->header.postingsOffset;
+    term->wordOffset = writer->wordBytes;
+    term->docCount = list->docCount;
+    memcpy(writer->words + writer->wordBytes, word, length);
+    writer->wordBytes += length;
+
+    // At most five bytes per value
+    if ((size_t)list->count * 5 > writer->bufferCapacity) {
+        writer->bufferCapacity = (size_t)list->count * 5;
+        writer->buffer = realloc(writer->buffer, writer->bufferCapacity);
+        if (!writer->buffer) {
+            perror("Error allocating memory for postings");
+            exit(1);
+        }
+    }
+    int positional = (writer->header.flags & INDEX_FILE_POSITIONS) != 0;
+    size_t bytes = 0;
+    uint32_t previous = 0;
+    for (uint32_t k = 0; k < list->count; k += recordLength(list->values + k, positional)) {
+        uint32_t gap = list->values[k] - previous;
+        previous = list->values[k];
+        if (!positional) {
+            bytes += encodeVarint(writer->buffer + bytes, gap);
+        } else {
+            // Most terms occur once in a document, so a frequency of one
+            // is a flag in the gap rather than a byte of its own
+            uint32_t frequency = list->values[k + 1];
+            const uint32_t *positions = list->values + k + 2;
+            bytes += encodeVarint(writer->buffer + bytes, (uint64_t)gap << 1 | (frequency == 1));
+            if (frequency != 1) {
+                bytes += encodeVarint(writer->buffer + bytes, frequency);
+            }
+            for (uint32_t p = 0; p < frequency; p++) {
+                bytes += encodeVarint(writer->buffer + bytes,
+                                      positions[p] - (p > 0 ? positions[p - 1] : 0));
+            }
+        }
+    }
+    writeIndexBytes(writer, writer->buffer, bytes);
+}
+
+// Function to write a value as a LEB128 varint, returning its length
+size_t encodeVarint(unsigned char *out, uint64_t value) {
+    size_t length = 0;
+    while (value >= 0x80) {
+        out[length++] = (value & 0x7F) | 0x80;
+        value >>= 7;
+    }
+    out[length++] = value;
+    return length;
+}
+
+// Function to finish the binary index with the term dictionary and header
+void closeIndexWriter(IndexWriter *writer) {
+    padIndexWriter(writer);
+    writer->header.termsOffset = writer->offset;
+    writeIndexBytes(writer, writer->terms, (size_t)writer->header.numTerms * sizeof(IndexTerm));
+    writer->header.wordsOffset = writer->offset;
+    writeIndexBytes(writer, writer->words, writer->wordBytes);
+
+    IndexFileHeader *header = &writer->header;
+    memcpy(header->magic, INDEX_FILE_MAGIC, sizeof(header->magic));
+    header->version = INDEX_FILE_VERSION;
+    header->fileSize = writer->offset;
+    header->bodyChecksum = writer->checksum;
+    header->headerChecksum = indexChecksum(0, header, offsetof(IndexFileHeader, headerChecksum));
+    if (fseek(writer->file, 0, SEEK_SET) != 0 ||
+        fwrite(header, sizeof(IndexFileHeader), 1, writer->file) != 1 ||
+        fclose(writer->file) != 0) {
+        perror("Error writing invertedIndex.bin");
+        exit(1);
+    }
+    free(writer->terms);
+    free(writer->words);
+    free(writer->buffer);
+}
+
+// Function to index every document of the table on numThreads threads
+void buildIndex(IndexBuilder *builder, DocTable *docs, int numThreads, size_t memoryBudget,
+                int positional, int scalarTokenizer) {
+    builder->docs = docs;
+    builder->numThreads = numThreads;
+    builder->memoryBudget = memoryBudget;
+    builder->positional = positional;
+    builder->scalarTokenizer = scalarTokenizer;
+    builder->workers = calloc(numThreads, sizeof(IndexWorker));
+    builder->splitters = malloc((numThreads > 1 ? numThreads - 1 : 1) * sizeof(char *));
+    if (!builder->workers || !builder->splitters) {
+        perror("Error allocating memory for index workers");
+        exit(1);
+    }
+    partitionDocuments(builder);
+
+    pthread_barrier_init(&builder->barrier, NULL, numThreads);
+    for (int t = 0; t < numThreads; t++) {
+        builder->workers[t].id = t;
+        builder->workers[t].builder = builder;
+    }
+    for (int t = 1; t < numThreads; t++) {
+        if (pthread_create(&builder->workers[t].thread, NULL, runIndexWorker,
+                           &builder->workers[t]) != 0) {
+            perror("Error creating index worker");
+            exit(1);
+        }
+    }
+    runIndexWorker(&builder->workers[0]);
+    for (int t = 1; t < numThreads; t++) {
+        pthread_join(builder->workers[t].thread, NULL);
+    }
+    pthread_barrier_destroy(&builder->barrier);
+
+    builder->spilled = 0;
+    builder->terms = NULL;
+    builder->termCount = 0;
+    for (int t = 0; t < numThreads; t++) {
+        builder->spilled |= builder->workers[t].spilled;
+    }
+    if (builder->spilled) {
+        return;
+    }
+
+    // The key ranges are in order, so the index is their concatenation
+    for (int t = 0; t < numThreads; t++) {
+        builder->termCount += builder->workers[t].mergedCount;
+    }
+    builder->terms = malloc((builder->termCount > 0 ? builder->termCount : 1) * sizeof(TermEntry));
+    if (!builder->terms) {
+        perror("Error allocating memory for merged terms");
+        exit(1);
+    }
+    size_t count = 0;
+    for (int t = 0; t < numThreads; t++) {
+        IndexWorker *worker = &builder->workers[t];
+        memcpy(builder->terms + count, worker->merged, worker->mergedCount * sizeof(TermEntry));
+        count += worker->mergedCount;
+        free(worker->merged);
+        worker->merged = NULL;
+    }
+}
+
+// Function to free the merged index and every partial index
+void freeIndexBuilder(IndexBuilder *builder) {
+    for (int t = 0; t < builder->numThreads; t++) {
+        IndexWorker *worker = &builder->workers[t];
+        free(worker->run);
+        freeInvertedIndex(&worker->partial);
+        freeArena(&worker->mergeArena);
+        for (int k = 0; k < worker->numRuns; k++) {
+            fclose(worker->runFiles[k]);
+        }
+        free(worker->runFiles);
+        freeTokenScanner(&worker->scanner);
+    }
+    free(builder->workers);
+    free(builder->splitters);
+    free(builder->terms);
 }
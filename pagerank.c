@@ -14,32 +14,547 @@
 // 
 //    <URL>, <out-degree>, <PageRank>
 //
+// Graphs too large for memory can be ranked out-of-core from a binary edge
+// file (see `--write-edges` and `--edge-file`). Only the rank vectors are
+// kept in RAM; the edges are streamed sequentially from the file every
+// iteration using partitioned scatter/gather phases.
+//
+// The in-memory calculation runs on `--threads N` threads over a CSR of the
+// incoming links. With `--numa` the threads are pinned across NUMA nodes and
+// each thread first touches its own slice of the graph and rank vectors.
+//
+// With `--shards N` the iteration is split across N worker processes, each
+// owning a contiguous range of pages. Workers publish the contributions of
+// their pages through shared memory and report their residuals to the
+// coordinating process over Unix sockets, which decides global convergence.
+//
+// `--block-rank RULE` seeds the iteration with a two-level BlockRank
+// estimate: URLs are grouped into blocks by host, prefix or regex, ranked
+// locally inside every block and weighted by the rank of their block.
+//
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <stdio.h>
 #include <math.h>
 #include <string.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <dirent.h>
+#ifdef __SSSE3__
+#include <tmmintrin.h>
+#endif
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <linux/perf_event.h>
+#include <errno.h>
+#include <regex.h>
+
+#include "edgeFile.h"
 
 #define MAX_URL_LENGTH 100
 #define MAX_URLS 1000
 
+// Bytes of the edge file mapped and streamed per window
+#define EDGE_WINDOW_BYTES (64L * 1024 * 1024)
+// Total bytes of in-memory update buffers shared by all partitions
+#define UPDATE_BUFFER_BYTES (16L * 1024 * 1024)
+// Vertices per partition, sized so a partition's ranks stay cache resident
+#define PARTITION_VERTICES 65536
+
+#define HUGE_PAGE_SIZE (2L * 1024 * 1024)
+// Most vectors a single calculation allocates
+#define MAX_VECTORS 16
+#define TASKS_PER_THREAD 8
+#define DETERMINISTIC_BLOCK 256
+// Bytes readable past the end of compressed lists by 16-byte SIMD loads
+#define VBYTE_PADDING 16
+
 typedef struct {
     char url[MAX_URL_LENGTH];
     int outDegree;
     double pageRank;
-    int links[MAX_URLS];
+    int links[MAX_URLS];    // number of links to every page
 } Page;
 
+// Incoming links of every page in compressed sparse row form: the pages
+// linking to page i are inSources[inOffsets[i] .. inOffsets[i + 1]).
+// Vertex ids in inSources are indexBytes wide: uint32_t as built, or
+// uint64_t when the engine is forced to the wide instantiation.
+//
+// A compressed graph stores each list as ascending gaps in Stream VByte
+// form instead, starting at inBytes[inByteOffsets[i]]: one control byte
+// per four gaps, holding their byte lengths, followed by the gap bytes.
+// inSources is then NULL.
+//
+// A weighted graph also stores the weight of every incoming link in
+// inWeights, parallel to inSources, and the total weight of the outgoing
+// links of every page in outWeight. Both are NULL for unweighted graphs.
+// As built the weights are doubles; the engine's copy holds them in the
+// kernel's rank type.
+typedef struct {
+    int N;
+    long numEdges;
+    long *inOffsets;
+    void *inSources;
+    int indexBytes;
+    int *outDegree;
+    long *inByteOffsets;
+    unsigned char *inBytes;
+    void *inWeights;
+    double *outWeight;
+} Graph;
+
+// Hardware events counted with --perf-counters
+enum {
+    COUNTER_CYCLES,
+    COUNTER_INSTRUCTIONS,
+    COUNTER_LLC_MISSES,
+    COUNTER_DTLB_MISSES,
+    COUNTER_BRANCH_MISSES,
+    NUM_COUNTERS
+};
+
+// Phases of an iteration the counters are attributed to
+enum {
+    PERF_PHASE_KERNEL,      // the rank kernel over the thread's pages
+    PERF_PHASE_BARRIER,     // waiting for the other threads
+    PERF_PHASE_REDUCE,      // residual reduction and bookkeeping
+    NUM_PERF_PHASES
+};
+
+// Counters of one thread, opened as a single perf event group
+typedef struct {
+    int leader;                 // group leader fd, or -1 when unavailable
+    int error;                  // errno of the failed leader
+    int numOpen;
+    int index[NUM_COUNTERS];    // position in the group read, or -1
+    int fds[NUM_COUNTERS];
+    uint64_t last[NUM_COUNTERS];
+    uint64_t totals[NUM_PERF_PHASES][NUM_COUNTERS];
+    int multiplexed;            // the group was not always on the PMU
+} PerfCounters;
+
+// Rank value types of the contribution vectors
+enum {
+    RANK_DOUBLE,
+    RANK_FLOAT
+};
+
+// Policies for the rank of pages without outgoing links
+enum {
+    DANGLING_DROP,          // lost, as in the original calculation
+    DANGLING_UNIFORM        // spread evenly over all pages
+};
+
+// Arguments and results of one rank kernel call over pages [lo, hi).
+// contrib and nextContrib hold float or double values depending on the
+// kernel instantiation.
+typedef struct {
+    const Graph *graph;
+    const void *contrib;
+    void *nextContrib;
+    double *pageRank;
+    int lo;
+    int hi;
+    double d;
+    double danglingRank;    // rank of the dangling pages in the last iteration
+    double diff;            // L1 change of the ranks
+    double maxDiff;         // largest single change
+    double danglingSum;     // rank of the dangling pages among [lo, hi)
+} KernelArgs;
+
+typedef void (*RankKernel)(KernelArgs *args);
+
+// Telemetry written as JSON lines, one object per event
+typedef struct {
+    FILE *file;             // NULL when telemetry is off
+    double phaseWall;       // wall clock at the start of the current phase
+    double phaseCpu;        // process CPU time at the start of the current phase
+    int iterations;
+    long edges;
+    double iterateSeconds;
+} Telemetry;
+
+// Huge page policies for the graph and rank vectors
+enum {
+    HUGE_PAGES_OFF,
+    HUGE_PAGES_TRANSPARENT,
+    HUGE_PAGES_EXPLICIT
+};
+
+typedef struct {
+    void *base;
+    size_t length;      // mapped length, rounded to huge pages if eligible
+    size_t bytes;       // requested length
+    int explicitHuge;   // mapped from the hugetlbfs pool
+} AllocatedVector;
+
+// Vectors allocated for one calculation, freed together
+typedef struct {
+    int hugePages;
+    int count;
+    size_t eligibleBytes;
+    AllocatedVector vectors[MAX_VECTORS];
+} VectorAllocator;
+
+// Schedulers of the pull-mode iteration
+enum {
+    SCHEDULE_DEFAULT,       // static, without the busy and idle report
+    SCHEDULE_STATIC,        // every thread runs its own slice
+    SCHEDULE_STEAL          // idle threads steal tasks from the others
+};
+
+// Accumulation strategies of the push-mode iteration
+enum {
+    PUSH_OFF,
+    PUSH_AUTO,              // per-thread buffers on dense graphs, else atomics
+    PUSH_ATOMIC,            // atomic adds into one shared sum vector
+    PUSH_BUFFERED           // per-thread sum vectors combined by the page owners
+};
+
+// Options of the in-memory calculation
+typedef struct {
+    int numThreads;
+    int numa;
+    int hugePages;
+    int compress;
+    Telemetry *telemetry;
+    int weighted;                   // weight links by their multiplicity
+    const char *linkWeights;        // file of supplied link weights, or NULL
+    const char *checkpointPath;     // NULL when checkpoints are off
+    int checkpointEvery;            // iterations between checkpoints
+    int resume;
+    int perfCounters;
+    int rankType;                   // RANK_DOUBLE or RANK_FLOAT
+    int dangling;                   // DANGLING_DROP or DANGLING_UNIFORM
+    int indexWidth;                 // 32, 64 or 0 for the narrowest that fits
+    int topK;                       // stop once the top K are certified, or 0
+    int push;                       // PUSH_OFF for the pull kernels
+    int frontier;                   // push only sources whose rank changed
+    int schedule;
+    int deterministic;              // reductions independent of the thread count
+} RankOptions;
+
+// Checkpoint file layout: CheckpointHeader followed by double pageRank[N]
+#define CHECKPOINT_MAGIC "PRC1"
+#define CHECKPOINT_VERSION 1
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint64_t fingerprint;   // hash of the URLs and links of the graph
+    uint64_t numPages;
+    uint64_t numEdges;
+    int64_t iteration;
+    double d;
+    double diffPR;
+} CheckpointHeader;
+
+// Background writer of checkpoints. The rank iteration hands it a copy of
+// the rank vector and carries on; a snapshot arriving while the previous
+// one is still being written is skipped rather than waited for.
+typedef struct {
+    const char *path;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    int pending;            // snapshot waiting to be written
+    int busy;               // pending or being written
+    int stop;
+    CheckpointHeader header;
+    double *snapshot;
+    int written;
+    int skipped;
+} Checkpointer;
+
+typedef struct RankEngine RankEngine;
+
+// Unit of work of the work-stealing scheduler: the pages [lo, hi), or for a
+// page split across tasks the part [edgeLo, edgeHi) of its incoming links,
+// whose partial sum goes to the engine's partialSums[slot]
+typedef struct {
+    int lo;
+    int hi;
+    long edgeLo;
+    long edgeHi;
+    int slot;               // -1 for a range of pages
+} RankTask;
+
+// Tasks of one thread for the current iteration, tasks[head .. tail). The
+// owner takes tasks from the head, thieves from the tail.
+typedef struct {
+    pthread_mutex_t lock;
+    int first;              // initial head and tail
+    int last;
+    int head;
+    int tail;
+} TaskDeque;
+
+// Page whose incoming links are split across slots [firstSlot, lastSlot)
+typedef struct {
+    int page;
+    int firstSlot;
+    int lastSlot;
+} SplitPage;
+
+// State of one thread of the parallel rank iteration
+typedef struct {
+    RankEngine *engine;
+    pthread_t thread;
+    int id;
+    int lo;             // first page owned by the thread
+    int hi;             // one past the last page owned by the thread
+    int cpu;            // CPU the thread is pinned to, or -1
+    int node;           // NUMA node of that CPU, or -1
+    double residual;
+    double maxResidual;
+    double danglingSum;
+    double seconds;     // time spent in the rank kernel
+    double idleSeconds; // time spent waiting at barriers
+    double bytes;       // bytes streamed by the rank kernel
+    int tasksRun;
+    int tasksStolen;
+    PerfCounters *counters;     // NULL unless --perf-counters is on
+} RankWorker;
+
+// Shared state of the parallel rank iteration
+struct RankEngine {
+    const Graph *staging;   // graph as built, copied over slice by slice
+    Graph graph;            // copy first touched by the owning threads
+    const Page *pages;      // starting ranks, copied over slice by slice
+    double *pageRank;
+    void *contrib;          // contributions read by the current iteration
+    void *nextContrib;      // contributions produced for the next one
+    int rankBytes;          // size of one contribution
+    RankKernel kernel;
+    double d;
+    double danglingRank;
+    double diffPR;
+    int maxIterations;
+    int iteration;
+    int done;
+    double iterationStart;  // wall clock when the current iteration began
+    Telemetry *telemetry;
+    Checkpointer *checkpointer;
+    int checkpointEvery;
+    CheckpointHeader checkpointHeader;
+    int topK;
+    int certifiedK;         // leading pages whose identity and order are certain
+    int *topPages;          // scratch for the top topK + 1 pages
+    double residual;        // L1 change of the last iteration
+    double lastResidual;    // and of the one before
+    int stoppedEarly;
+    int uniformDangling;
+    int numThreads;
+    int pinThreads;
+    RankWorker *workers;
+    pthread_barrier_t barrier;
+    VectorAllocator allocator;
+    int schedule;
+    RankTask *tasks;        // work-stealing tasks, NULL for static slices
+    int numTasks;
+    TaskDeque *deques;
+    double *partialSums;
+    SplitPage *splitPages;
+    int numSplitPages;
+    int blockSize;          // pages per reduction block, 0 unless deterministic
+    int numBlocks;
+    double *blockDiff;      // L1 change, largest change and dangling rank
+    double *blockMaxDiff;   // of every block
+    double *blockDangling;
+};
+
+// Contribution destined for one vertex, produced by the scatter phase
+typedef struct {
+    uint32_t dst;
+    double value;
+} RankUpdate;
+
+// Per-partition buffer of updates waiting for the gather phase
+typedef struct {
+    RankUpdate *updates;
+    size_t count;
+} UpdateBuffer;
+
+typedef struct {
+    double pageRank;
+    uint32_t index;
+} RankedVertex;
+
+// Messages exchanged between the coordinator and the shard workers
+enum {
+    SHARD_CONTRIB_READY,
+    SHARD_GO,
+    SHARD_RESIDUAL,
+    SHARD_MAX_RESIDUAL,
+    SHARD_CONTINUE,
+    SHARD_STOP
+};
+
+typedef struct {
+    int type;
+    double value;
+} ShardMessage;
+
+typedef struct PushEngine PushEngine;
+
+// Thread of the push-mode iteration, owning pages [lo, hi) both as sources
+// it scatters from and as destinations it computes the new ranks of
+typedef struct {
+    PushEngine *engine;
+    pthread_t thread;
+    int id;
+    int lo;
+    int hi;
+    double residual;
+    double maxResidual;
+    long pushedEdges;       // edges scattered over all iterations
+} PushWorker;
+
+// Shared state of the push-mode iteration. The outgoing links of page j
+// are outTargets[outOffsets[j] .. outOffsets[j + 1]).
+struct PushEngine {
+    int N;
+    long numEdges;
+    long *outOffsets;
+    uint32_t *outTargets;
+    int *outDegree;
+    double *pageRank;
+    double *sums;           // incoming contributions of every page
+    double *buffers;        // numThreads per-thread sum vectors, NULL with atomics
+    double *pushed;         // contribution last pushed by every page, with frontier
+    double threshold;       // smallest change of a page worth pushing
+    int frontier;
+    double d;
+    double diffPR;
+    int maxIterations;
+    int iteration;
+    int done;
+    double iterationStart;
+    Telemetry *telemetry;
+    int numThreads;
+    PushWorker *workers;
+    pthread_barrier_t barrier;
+};
+
+// Shared state of the local rank solves of BlockRank. The pages of block b
+// are members[blockStart[b] .. blockStart[b + 1]).
+typedef struct {
+    const Graph *graph;
+    const int *blockOf;
+    const int *blockStart;
+    const int *members;
+    const double *localOut; // weight of the links of every page to its own block
+    double *localRank;
+    double *scratch;
+    int numBlocks;
+    double d;
+    double diffPR;
+    int maxIterations;
+    pthread_mutex_t lock;
+    int nextBlock;          // next block to solve, under lock
+    long iterations;        // local iterations over all blocks, under lock
+} BlockRankJob;
+
 // Function Prototypes
 int readCollection(Page pages[], int maxPages);
-void calculatePageRank(Page pages[], int N, double d, double diffPR, int maxIterations);
-void writePageRankToFile(Page pages[], int N);
+void calculatePageRank(Page pages[], int N, double d, double diffPR, int maxIterations,
+                       const RankOptions *options);
+void writePageRankToFile(Page pages[], int N, Telemetry *telemetry);
 int findPageIndex(Page pages[], int N, const char *url);
 int comparePageRank(const void *a, const void *b);
 
 // Helper Functions for PageRank Calculation
-void initializePreviousRanks(Page pages[], double prevPR[], int N);
-void calculateNewRanks(Page pages[], double prevPR[], int N, double d);
-double computePageRankDiff(Page pages[], double prevPR[], int N);
+void buildGraph(Page pages[], int N, Graph *graph);
+void freeGraph(Graph *graph);
+void weightGraph(Page pages[], Graph *graph, const char *linkWeights);
+void *allocateVector(VectorAllocator *allocator, size_t bytes);
+void freeVectors(VectorAllocator *allocator);
+size_t transparentHugeBytes(VectorAllocator *allocator);
+void reportHugePages(VectorAllocator *allocator);
+int cpuNode(int cpu);
+void assignCpus(RankWorker workers[], int numThreads);
+void partitionPages(const Graph *graph, RankWorker workers[], int numThreads);
+void buildRankTasks(RankEngine *engine);
+RankTask *nextRankTask(RankEngine *engine, RankWorker *worker);
+double partialInSum(const Graph *graph, const void *contrib, int rankBytes, long lo, long hi);
+double rankTaskBytes(const RankEngine *engine, const RankTask *task);
+void finishSplitPages(RankEngine *engine, double *diff, double *maxDiff, double *danglingRank);
+void reportSchedule(RankEngine *engine);
+void runRankBlocks(RankEngine *engine, KernelArgs *args, int lo, int hi);
+double pairwiseSum(const double values[], int count);
+double elapsedSeconds(const struct timespec *start);
+RankKernel selectRankKernel(const Graph *graph, int rankType, int dangling, int indexWidth,
+                            int *indexBytes);
+void initStreamVByte(void);
+long encodeStreamVByte(const uint32_t values[], long count, unsigned char *out);
+void compressGraph(Graph *graph);
+void *runRankWorker(void *arg);
+void reportNodeBandwidth(RankEngine *engine);
+int certifyTopK(const double pageRank[], int N, int k, double error, int top[]);
+void reportTopK(RankEngine *engine);
+
+// Hardware performance counters
+void openPerfCounters(PerfCounters *counters);
+void samplePerfCounters(PerfCounters *counters, int phase);
+void closePerfCounters(PerfCounters *counters);
+void reportPerfCounters(RankEngine *engine);
+
+// Checkpoints
+uint64_t fingerprintGraph(Page pages[], const Graph *graph);
+int readCheckpoint(const char *path, const CheckpointHeader *expected, double pageRank[]);
+void *runCheckpointer(void *arg);
+void startCheckpointer(Checkpointer *checkpointer, const char *path, int N);
+void requestCheckpoint(Checkpointer *checkpointer, const CheckpointHeader *header,
+                       const double pageRank[]);
+void stopCheckpointer(Checkpointer *checkpointer);
+
+// Out-of-core PageRank over a binary edge file
+void writeEdgeFile(Page pages[], int N, const char *path);
+void calculatePageRankOutOfCore(const char *path, double d, double diffPR,
+                                int maxIterations, int numPartitions, Telemetry *telemetry);
+void gatherUpdates(UpdateBuffer *buffer, double sums[]);
+int compareRankedVertex(const void *a, const void *b);
+
+// Telemetry
+double wallSeconds(void);
+double cpuSeconds(void);
+void beginPhase(Telemetry *telemetry);
+double endPhase(Telemetry *telemetry, const char *phase);
+void recordIteration(Telemetry *telemetry, int iteration, double l1, double linf,
+                     double seconds);
+void recordSummary(Telemetry *telemetry);
+
+// Multi-process sharded PageRank
+void calculatePageRankSharded(Page pages[], int N, double d, double diffPR,
+                              int maxIterations, int numShards, Telemetry *telemetry);
+void runShardWorker(Page pages[], int N, double d, int lo, int hi, int fd,
+                    double contrib[], double sharedPR[]);
+void sendShardMessage(int fd, int type, double value);
+double receiveShardMessage(int fd, int expectedType, int *type);
+
+// Push-mode PageRank
+void atomicAddDouble(double *target, double value);
+void *runPushWorker(void *arg);
+void calculatePageRankPush(Page pages[], int N, double d, double diffPR, int maxIterations,
+                           const RankOptions *options);
+
+// BlockRank initialization
+int blockKey(const char *url, const char *rule, const regex_t *regex, char key[]);
+int assignBlocks(Page pages[], int N, const char *rule, int blockOf[]);
+void *solveLocalRanks(void *arg);
+void seedBlockRank(Page pages[], int N, double d, double diffPR, int maxIterations,
+                   const char *rule, int numThreads, const RankOptions *options);
 
 // Function Definitions
 int findPageIndex(Page pages[], int N, const char *url) {
@@ -70,7 +585,7 @@ void processSection1(FILE *urlFile, Page *pages, int N, int i) {
             while (token != NULL) {
                 int linkedIndex = findPageIndex(pages, N, token);
                 if (linkedIndex != -1 && linkedIndex != i) {
-                    pages[i].links[linkedIndex] = 1;
+                    pages[i].links[linkedIndex]++;
                     pages[i].outDegree++;
                 }
                 token = strtok(NULL, " \n");
@@ -124,78 +639,3149 @@ int readCollection(Page pages[], int maxPages) {
     return N;
 }
 
-void initializePreviousRanks(Page pages[], double prevPR[], int N) {
+// Function to build the incoming-link CSR of the parsed collection
+void buildGraph(Page pages[], int N, Graph *graph) {
+    graph->N = N;
+    graph->numEdges = 0;
+    graph->inOffsets = malloc((N + 1) * sizeof(long));
+    graph->outDegree = malloc((N > 0 ? N : 1) * sizeof(int));
+    if (!graph->inOffsets || !graph->outDegree) {
+        perror("Error allocating graph");
+        exit(1);
+    }
+
+    graph->inOffsets[0] = 0;
     for (int i = 0; i < N; i++) {
-        prevPR[i] = pages[i].pageRank;
+        for (int j = 0; j < N; j++) {
+            graph->numEdges += pages[j].links[i] != 0;
+        }
+        graph->inOffsets[i + 1] = graph->numEdges;
+        graph->outDegree[i] = pages[i].outDegree;
     }
-}
 
-void calculateNewRanks(Page pages[], double prevPR[], int N, double d) {
+    graph->inByteOffsets = NULL;
+    graph->inBytes = NULL;
+    uint32_t *sources = malloc((graph->numEdges > 0 ? graph->numEdges : 1) * sizeof(uint32_t));
+    if (!sources) {
+        perror("Error allocating graph");
+        exit(1);
+    }
+    long e = 0;
     for (int i = 0; i < N; i++) {
-        double sum = 0.0;
         for (int j = 0; j < N; j++) {
             if (pages[j].links[i]) {
-                if (pages[j].outDegree != 0) {
-                    sum += prevPR[j] / pages[j].outDegree;
+                sources[e++] = j;
+            }
+        }
+    }
+    graph->inSources = sources;
+    graph->indexBytes = sizeof(uint32_t);
+    graph->inWeights = NULL;
+    graph->outWeight = NULL;
+}
+
+// Function to weight the links of a graph by their multiplicity, so that a
+// page linking to another twice passes it twice the share of its rank. The
+// weights of links listed in linkWeights, one "fromUrl toUrl weight" per
+// line, replace their multiplicity. A page's rank is split in proportion
+// to the weights of its outgoing links.
+void weightGraph(Page pages[], Graph *graph, const char *linkWeights) {
+    int N = graph->N;
+    const uint32_t *sources = graph->inSources;
+    double *inWeights = malloc((graph->numEdges > 0 ? graph->numEdges : 1) * sizeof(double));
+    graph->outWeight = calloc(N > 0 ? N : 1, sizeof(double));
+    if (!inWeights || !graph->outWeight) {
+        perror("Error allocating link weights");
+        exit(1);
+    }
+    for (int i = 0; i < N; i++) {
+        for (long e = graph->inOffsets[i]; e < graph->inOffsets[i + 1]; e++) {
+            inWeights[e] = pages[sources[e]].links[i];
+        }
+    }
+
+    if (linkWeights) {
+        FILE *file = fopen(linkWeights, "r");
+        if (!file) {
+            perror("Error opening link weights");
+            exit(1);
+        }
+        char from[MAX_URL_LENGTH], to[MAX_URL_LENGTH];
+        double weight;
+        int ignored = 0;
+        while (fscanf(file, "%99s %99s %lf", from, to, &weight) == 3) {
+            int j = findPageIndex(pages, N, from);
+            int i = findPageIndex(pages, N, to);
+            long lo = i >= 0 ? graph->inOffsets[i] : 0;
+            long hi = i >= 0 ? graph->inOffsets[i + 1] : 0;
+            // Sources of every incoming-link list are ascending
+            while (lo < hi) {
+                long mid = (lo + hi) / 2;
+                if (sources[mid] < (uint32_t)j) {
+                    lo = mid + 1;
                 } else {
-                    sum += prevPR[j] / N;
+                    hi = mid;
                 }
             }
+            if (i < 0 || j < 0 || weight < 0 || lo == graph->inOffsets[i + 1] ||
+                sources[lo] != (uint32_t)j) {
+                ignored++;
+                continue;
+            }
+            inWeights[lo] = weight;
+        }
+        fclose(file);
+        if (ignored > 0) {
+            fprintf(stderr, "link weights: ignored %d entries that are not links\n", ignored);
         }
-        pages[i].pageRank = ((1 - d) / N) + (d * sum);
     }
-}
 
-double computePageRankDiff(Page pages[], double prevPR[], int N) {
-    double diff = 0.0;
     for (int i = 0; i < N; i++) {
-        diff += fabs(pages[i].pageRank - prevPR[i]);
+        for (long e = graph->inOffsets[i]; e < graph->inOffsets[i + 1]; e++) {
+            graph->outWeight[sources[e]] += inWeights[e];
+        }
     }
-    return diff;
+    graph->inWeights = inWeights;
 }
 
-void calculatePageRank(Page pages[], int N, double d, double diffPR, int maxIterations) {
-    double prevPR[MAX_URLS];
-    int iteration = 0;
-    double diff;
+void freeGraph(Graph *graph) {
+    free(graph->inOffsets);
+    free(graph->inSources);
+    free(graph->outDegree);
+    free(graph->inByteOffsets);
+    free(graph->inBytes);
+    free(graph->inWeights);
+    free(graph->outWeight);
+}
 
-    do {
-        initializePreviousRanks(pages, prevPR, N);
-        calculateNewRanks(pages, prevPR, N, d);
-        diff = computePageRankDiff(pages, prevPR, N);
-        iteration++;
-    } while (iteration < maxIterations && diff >= diffPR);
+// Function to allocate a vector whose pages are not touched until the
+// thread that owns each slice first writes it. Vectors of at least one huge
+// page are backed by huge pages when the allocator asks for them: explicit
+// mode maps them from the hugetlbfs pool and falls back to transparent huge
+// pages, which fall back to normal pages if the kernel has none to give.
+void *allocateVector(VectorAllocator *allocator, size_t bytes) {
+    if (allocator->count == MAX_VECTORS) {
+        fprintf(stderr, "Error: too many rank vectors\n");
+        exit(1);
+    }
+    AllocatedVector *vector = &allocator->vectors[allocator->count];
+    vector->bytes = bytes;
+    vector->explicitHuge = 0;
+
+    int huge = allocator->hugePages != HUGE_PAGES_OFF && bytes >= HUGE_PAGE_SIZE;
+    size_t length = bytes > 0 ? bytes : 1;
+    if (huge) {
+        length = (bytes + HUGE_PAGE_SIZE - 1) & ~(size_t)(HUGE_PAGE_SIZE - 1);
+        allocator->eligibleBytes += length;
+    }
+
+    void *base = MAP_FAILED;
+    if (huge && allocator->hugePages == HUGE_PAGES_EXPLICIT) {
+        base = mmap(NULL, length, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (base != MAP_FAILED) {
+            vector->explicitHuge = 1;
+        }
+    }
+    if (base == MAP_FAILED && huge) {
+        // Over-map so the vector can start on a huge page boundary
+        char *raw = mmap(NULL, length + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (raw != MAP_FAILED) {
+            char *aligned = (char *)(((uintptr_t)raw + HUGE_PAGE_SIZE - 1) &
+                                     ~(uintptr_t)(HUGE_PAGE_SIZE - 1));
+            if (aligned > raw) {
+                munmap(raw, aligned - raw);
+            }
+            munmap(aligned + length, raw + HUGE_PAGE_SIZE - aligned);
+            madvise(aligned, length, MADV_HUGEPAGE);
+            base = aligned;
+        }
+    }
+    if (base == MAP_FAILED) {
+        base = mmap(NULL, length, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    }
+    if (base == MAP_FAILED) {
+        perror("Error allocating rank vectors");
+        exit(1);
+    }
+
+    vector->base = base;
+    vector->length = length;
+    allocator->count++;
+    return base;
 }
 
-void writePageRankToFile(Page pages[], int N) {
-    FILE *file = fopen("pagerankList.txt", "w");
-    if (!file) {
-        perror("Error opening pagerankList.txt");
+void freeVectors(VectorAllocator *allocator) {
+    for (int k = 0; k < allocator->count; k++) {
+        munmap(allocator->vectors[k].base, allocator->vectors[k].length);
+    }
+    allocator->count = 0;
+}
+
+// Function to count the bytes of the transparent-eligible vectors that the
+// kernel has backed with transparent huge pages, according to
+// /proc/self/smaps. Neighbouring mappings with the same flags merge into one
+// VMA, so each VMA is counted once, and at most for the bytes of it that the
+// vectors cover. The vectors are separate mappings and never overlap.
+size_t transparentHugeBytes(VectorAllocator *allocator) {
+    FILE *smaps = fopen("/proc/self/smaps", "r");
+    if (!smaps) {
+        return 0;
+    }
+
+    size_t covered = 0;
+    size_t total = 0;
+    char line[512];
+    while (fgets(line, sizeof(line), smaps)) {
+        unsigned long start, end;
+        unsigned long kb;
+        if (sscanf(line, "%lx-%lx ", &start, &end) == 2) {
+            covered = 0;
+            for (int k = 0; k < allocator->count; k++) {
+                AllocatedVector *vector = &allocator->vectors[k];
+                if (vector->explicitHuge || vector->length < HUGE_PAGE_SIZE) {
+                    continue;
+                }
+                uintptr_t lo = (uintptr_t)vector->base;
+                uintptr_t hi = lo + vector->length;
+                if (start < hi && end > lo) {
+                    covered += (end < hi ? end : hi) - (start > lo ? start : lo);
+                }
+            }
+        } else if (covered > 0 && sscanf(line, "AnonHugePages: %lu kB", &kb) == 1) {
+            size_t bytes = kb * 1024;
+            total += bytes < covered ? bytes : covered;
+        }
+    }
+    fclose(smaps);
+    return total;
+}
+
+void reportHugePages(VectorAllocator *allocator) {
+    size_t explicitBytes = 0;
+    for (int k = 0; k < allocator->count; k++) {
+        if (allocator->vectors[k].explicitHuge) {
+            explicitBytes += allocator->vectors[k].length;
+        }
+    }
+    size_t transparentBytes = transparentHugeBytes(allocator);
+    fprintf(stderr, "huge pages: %.1f of %.1f MB eligible "
+            "(%.1f MB hugetlbfs, %.1f MB transparent)\n",
+            (explicitBytes + transparentBytes) / 1e6, allocator->eligibleBytes / 1e6,
+            explicitBytes / 1e6, transparentBytes / 1e6);
+}
+
+// Function to find the NUMA node of a CPU, or -1 when it is not known
+int cpuNode(int cpu) {
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+    DIR *dir = opendir(path);
+    if (!dir) {
+        return -1;
+    }
+
+    int node = -1;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strncmp(entry->d_name, "node", 4) == 0 && isdigit((unsigned char)entry->d_name[4])) {
+            node = atoi(entry->d_name + 4);
+            break;
+        }
+    }
+    closedir(dir);
+    return node;
+}
+
+// Function to choose a CPU for every worker. CPUs are taken round-robin
+// across NUMA nodes so that the partitions spread over every socket.
+void assignCpus(RankWorker workers[], int numThreads) {
+    cpu_set_t allowed;
+    int cpus[CPU_SETSIZE];
+    int nodes[CPU_SETSIZE];
+    int used[CPU_SETSIZE];
+    int numCpus = 0;
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        perror("Error reading CPU affinity");
+        return;
+    }
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &allowed)) {
+            cpus[numCpus] = cpu;
+            nodes[numCpus] = cpuNode(cpu);
+            used[numCpus] = 0;
+            numCpus++;
+        }
+    }
+    if (numCpus == 0) {
+        return;
+    }
+
+    int node = -1;
+    for (int t = 0; t < numThreads; t++) {
+        // Pick the first unused CPU on the next node after the previous pick
+        int pick = -1;
+        for (int k = 0; k < numCpus && pick < 0; k++) {
+            if (!used[k] && nodes[k] > node) {
+                pick = k;
+            }
+        }
+        for (int k = 0; k < numCpus && pick < 0; k++) {
+            if (!used[k]) {
+                pick = k;
+            }
+        }
+        if (pick < 0) {
+            // More threads than CPUs: start sharing them again
+            for (int k = 0; k < numCpus; k++) {
+                used[k] = 0;
+            }
+            pick = t % numCpus;
+        }
+        used[pick] = 1;
+        node = nodes[pick];
+        workers[t].cpu = cpus[pick];
+        workers[t].node = nodes[pick];
+    }
+}
+
+// Function to split the pages into contiguous ranges with roughly equal
+// numbers of pages plus incoming links
+void partitionPages(const Graph *graph, RankWorker workers[], int numThreads) {
+    long total = graph->numEdges + graph->N;
+    int i = 0;
+    for (int t = 0; t < numThreads; t++) {
+        workers[t].lo = i;
+        long target = total * (t + 1) / numThreads;
+        while (i < graph->N && graph->inOffsets[i + 1] + i + 1 <= target) {
+            i++;
+        }
+        if (t == numThreads - 1) {
+            i = graph->N;
+        }
+        workers[t].hi = i;
+    }
+}
+
+// Function to cut the slice of every thread into tasks of about
+// 1 / TASKS_PER_THREAD of its edges and pages, queued on the thread's own
+// deque so that unstolen tasks keep their NUMA placement. A page with more
+// incoming links than a task holds is split into tasks over parts of its
+// links; compressed lists cannot be entered midway and are never split.
+//
+// With reduction blocks every block is a task of its own and no page is
+// split, so that the results do not depend on the thread count.
+void buildRankTasks(RankEngine *engine) {
+    const Graph *graph = engine->staging;
+    long grain = (graph->numEdges + graph->N) / ((long)engine->numThreads * TASKS_PER_THREAD);
+    if (grain < 1) {
+        grain = 1;
+    }
+    if (engine->blockSize > 0) {
+        grain = graph->numEdges + graph->N + 1;
+    }
+
+    // Every page opens at most one range task and its split tasks
+    long maxTasks = 2 * graph->N + graph->numEdges / grain + engine->numThreads + 1;
+    engine->tasks = malloc(maxTasks * sizeof(RankTask));
+    engine->deques = calloc(engine->numThreads, sizeof(TaskDeque));
+    engine->splitPages = malloc((graph->N > 0 ? graph->N : 1) * sizeof(SplitPage));
+    if (!engine->tasks || !engine->deques || !engine->splitPages) {
+        perror("Error allocating rank tasks");
         exit(1);
     }
 
-    qsort(pages, N, sizeof(Page), comparePageRank);
+    int numSlots = 0;
+    for (int t = 0; t < engine->numThreads; t++) {
+        TaskDeque *deque = &engine->deques[t];
+        pthread_mutex_init(&deque->lock, NULL);
+        deque->first = engine->numTasks;
 
-    for (int i = 0; i < N; i++) {
-        fprintf(file, "%s, %d, %.7f\n", pages[i].url, pages[i].outDegree, pages[i].pageRank);
+        int lo = engine->workers[t].lo;
+        long cost = 0;
+        for (int i = engine->workers[t].lo; i < engine->workers[t].hi; i++) {
+            if (engine->blockSize > 0 && i > lo && i % engine->blockSize == 0) {
+                engine->tasks[engine->numTasks++] = (RankTask){ lo, i, 0, 0, -1 };
+                lo = i;
+            }
+            long degree = graph->inOffsets[i + 1] - graph->inOffsets[i];
+            if (degree > grain && !graph->inBytes) {
+                if (i > lo) {
+                    engine->tasks[engine->numTasks++] = (RankTask){ lo, i, 0, 0, -1 };
+                }
+                SplitPage *split = &engine->splitPages[engine->numSplitPages++];
+                split->page = i;
+                split->firstSlot = numSlots;
+                for (long e = graph->inOffsets[i]; e < graph->inOffsets[i + 1]; e += grain) {
+                    long end = e + grain < graph->inOffsets[i + 1] ? e + grain :
+                               graph->inOffsets[i + 1];
+                    engine->tasks[engine->numTasks++] = (RankTask){ i, i + 1, e, end,
+                                                                    numSlots++ };
+                }
+                split->lastSlot = numSlots;
+                lo = i + 1;
+                cost = 0;
+                continue;
+            }
+            cost += degree + 1;
+            if (cost >= grain) {
+                engine->tasks[engine->numTasks++] = (RankTask){ lo, i + 1, 0, 0, -1 };
+                lo = i + 1;
+                cost = 0;
+            }
+        }
+        if (engine->workers[t].hi > lo) {
+            engine->tasks[engine->numTasks++] = (RankTask){ lo, engine->workers[t].hi,
+                                                            0, 0, -1 };
+        }
+        deque->last = engine->numTasks;
+        deque->head = deque->first;
+        deque->tail = deque->last;
+    }
+
+    engine->partialSums = calloc(numSlots > 0 ? numSlots : 1, sizeof(double));
+    if (!engine->partialSums) {
+        perror("Error allocating rank tasks");
+        exit(1);
     }
-    fclose(file);
 }
 
-int main(int argc, char **argv) {
-    if (argc != 4) {
-        fprintf(stderr, "Usage: %s d diffPR maxIterations\n", argv[0]);
-        return 1;
+// Function to take the next task of a thread: from the head of its own
+// deque, or when that is empty from the tail of another thread's. Returns
+// NULL when no task is left this iteration.
+RankTask *nextRankTask(RankEngine *engine, RankWorker *worker) {
+    for (int k = 0; k < engine->numThreads; k++) {
+        TaskDeque *deque = &engine->deques[(worker->id + k) % engine->numThreads];
+        RankTask *task = NULL;
+        pthread_mutex_lock(&deque->lock);
+        if (deque->head < deque->tail) {
+            task = k == 0 ? &engine->tasks[deque->head++] : &engine->tasks[--deque->tail];
+        }
+        pthread_mutex_unlock(&deque->lock);
+        if (task) {
+            worker->tasksRun++;
+            worker->tasksStolen += k != 0;
+            return task;
+        }
+    }
+    return NULL;
+}
+
+// Function to sum the contributions over incoming links [lo, hi) of any
+// graph layout the plain kernels accept
+double partialInSum(const Graph *graph, const void *contrib, int rankBytes, long lo, long hi) {
+    double sum = 0.0;
+    for (long e = lo; e < hi; e++) {
+        uint64_t j = graph->indexBytes == sizeof(uint64_t) ?
+                     ((const uint64_t *)graph->inSources)[e] :
+                     ((const uint32_t *)graph->inSources)[e];
+        double value = rankBytes == sizeof(float) ? ((const float *)contrib)[j] :
+                                                    ((const double *)contrib)[j];
+        if (graph->inWeights) {
+            value *= rankBytes == sizeof(float) ? ((const float *)graph->inWeights)[e] :
+                                                  ((const double *)graph->inWeights)[e];
+        }
+        sum += value;
     }
+    return sum;
+}
 
-    double d = atof(argv[1]);
-    double diffPR = atof(argv[2]);
-    int maxIterations = atoi(argv[3]);
+// Function to estimate the bytes the kernel streams for a task: offsets,
+// adjacency, weights and gathered contributions of its links, plus the rank,
+// contribution and degree of its pages. A split task reads only its part of
+// the links and writes one partial sum.
+double rankTaskBytes(const RankEngine *engine, const RankTask *task) {
+    const Graph *graph = &engine->graph;
+    long edgeLo = task->slot >= 0 ? task->edgeLo : graph->inOffsets[task->lo];
+    long edgeHi = task->slot >= 0 ? task->edgeHi : graph->inOffsets[task->hi];
+    long edges = edgeHi - edgeLo;
+    double bytes = edges * engine->rankBytes;
+    if (graph->inWeights) {
+        bytes += edges * engine->rankBytes;
+    }
+    if (task->slot >= 0) {
+        return bytes + edges * graph->indexBytes + sizeof(double);
+    }
+
+    int pages = task->hi - task->lo;
+    bytes += (pages + 1) * sizeof(long);
+    if (graph->inBytes) {
+        bytes += graph->inByteOffsets[task->hi] - graph->inByteOffsets[task->lo] +
+                 (pages + 1) * sizeof(long);
+    } else {
+        bytes += edges * graph->indexBytes;
+    }
+    return bytes + pages * (sizeof(double) + engine->rankBytes + sizeof(int));
+}
+
+// Function to merge the partial sums of the split pages in slot order and
+// update their ranks and contributions the way the kernel does, adding
+// their changes and dangling rank to the iteration's totals
+void finishSplitPages(RankEngine *engine, double *diff, double *maxDiff, double *danglingRank) {
+    const Graph *graph = &engine->graph;
+    int N = graph->N;
+    double d = engine->d;
+
+    for (int k = 0; k < engine->numSplitPages; k++) {
+        const SplitPage *split = &engine->splitPages[k];
+        int i = split->page;
+        double sum = 0.0;
+        for (int slot = split->firstSlot; slot < split->lastSlot; slot++) {
+            sum += engine->partialSums[slot];
+        }
+        if (engine->uniformDangling) {
+            sum += engine->danglingRank / N;
+        }
+        double newRank = ((1 - d) / N) + (d * sum);
+        double change = fabs(newRank - engine->pageRank[i]);
+        *diff += change;
+        if (change > *maxDiff) {
+            *maxDiff = change;
+        }
+        engine->pageRank[i] = newRank;
+
+        double outWeight = graph->outWeight ? graph->outWeight[i] : graph->outDegree[i];
+        double value = outWeight != 0 ? newRank / outWeight : 0.0;
+        if (outWeight == 0 && engine->uniformDangling) {
+            *danglingRank += newRank;
+        }
+        if (engine->rankBytes == sizeof(float)) {
+            ((float *)engine->nextContrib)[i] = (float)value;
+        } else {
+            ((double *)engine->nextContrib)[i] = value;
+        }
+    }
+}
+
+// Function to report on stderr how long every thread worked and waited,
+// and how many tasks it ran and stole
+void reportSchedule(RankEngine *engine) {
+    for (int t = 0; t < engine->numThreads; t++) {
+        RankWorker *worker = &engine->workers[t];
+        double total = worker->seconds + worker->idleSeconds;
+        fprintf(stderr, "thread %d: busy %.6f s, idle %.6f s (%.1f%%)", t, worker->seconds,
+                worker->idleSeconds, total > 0 ? 100.0 * worker->idleSeconds / total : 0.0);
+        if (engine->tasks) {
+            fprintf(stderr, ", %d tasks, %d stolen", worker->tasksRun, worker->tasksStolen);
+        }
+        fprintf(stderr, "\n");
+    }
+    if (engine->tasks) {
+        fprintf(stderr, "schedule: %d tasks per iteration, %d pages split\n",
+                engine->numTasks, engine->numSplitPages);
+    }
+}
+
+// Function to run the kernel over pages [lo, hi), which are aligned to
+// reduction blocks, one block at a time, keeping the results of every
+// block for the reduction
+void runRankBlocks(RankEngine *engine, KernelArgs *args, int lo, int hi) {
+    for (int blockLo = lo; blockLo < hi; blockLo += engine->blockSize) {
+        int b = blockLo / engine->blockSize;
+        args->lo = blockLo;
+        args->hi = blockLo + engine->blockSize < hi ? blockLo + engine->blockSize : hi;
+        engine->kernel(args);
+        engine->blockDiff[b] = args->diff;
+        engine->blockMaxDiff[b] = args->maxDiff;
+        engine->blockDangling[b] = args->danglingSum;
+    }
+}
+
+// Function to sum values by recursive halving, which keeps the rounding
+// error growing with the logarithm of the count and fixes the order of the
+// additions
+double pairwiseSum(const double values[], int count) {
+    if (count <= 8) {
+        double sum = 0.0;
+        for (int k = 0; k < count; k++) {
+            sum += values[k];
+        }
+        return sum;
+    }
+    int half = count / 2;
+    return pairwiseSum(values, half) + pairwiseSum(values + half, count - half);
+}
+
+double elapsedSeconds(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// Function template computing the new ranks of pages [lo, hi) from the
+// current contributions, specialized at compile time on the vertex id type
+// of inSources, the value type of the contribution vectors, the dangling
+// policy and whether links are weighted. Also produces the pages'
+// contributions for the next iteration. Sums are accumulated in double
+// whatever the contribution type, so a float instantiation only narrows
+// what is streamed from memory. Unweighted instantiations never touch the
+// weight arrays.
+#define DEFINE_RANK_KERNEL(NAME, ID_TYPE, RANK_TYPE, UNIFORM_DANGLING, WEIGHTED)      \
+void NAME(KernelArgs *args) {                                                       \
+    const Graph *graph = args->graph;                                               \
+    const ID_TYPE *inSources = graph->inSources;                                    \
+    const RANK_TYPE *inWeights = graph->inWeights;                                  \
+    const RANK_TYPE *contrib = args->contrib;                                       \
+    RANK_TYPE *nextContrib = args->nextContrib;                                     \
+    double *pageRank = args->pageRank;                                              \
+    int N = graph->N;                                                               \
+    double d = args->d;                                                             \
+    double danglingShare = args->danglingRank / N;                                  \
+    double diff = 0.0;                                                              \
+    double maxChange = 0.0;                                                         \
+    double danglingSum = 0.0;                                                       \
+                                                                                    \
+    for (int i = args->lo; i < args->hi; i++) {                                     \
+        double sum = 0.0;                                                           \
+        for (long e = graph->inOffsets[i]; e < graph->inOffsets[i + 1]; e++) {      \
+            if (WEIGHTED) {                                                         \
+                sum += inWeights[e] * contrib[inSources[e]];                        \
+            } else {                                                                \
+                sum += contrib[inSources[e]];                                       \
+            }                                                                       \
+        }                                                                           \
+        if (UNIFORM_DANGLING) {                                                     \
+            sum += danglingShare;                                                   \
+        }                                                                           \
+        double newRank = ((1 - d) / N) + (d * sum);                                 \
+        double change = fabs(newRank - pageRank[i]);                                \
+        diff += change;                                                             \
+        if (change > maxChange) {                                                   \
+            maxChange = change;                                                     \
+        }                                                                           \
+        pageRank[i] = newRank;                                                      \
+        double outWeight = WEIGHTED ? graph->outWeight[i] : graph->outDegree[i];    \
+        if (outWeight != 0) {                                                       \
+            nextContrib[i] = (RANK_TYPE)(newRank / outWeight);                      \
+        } else {                                                                    \
+            nextContrib[i] = 0;                                                     \
+            if (UNIFORM_DANGLING) {                                                 \
+                danglingSum += newRank;                                             \
+            }                                                                       \
+        }                                                                           \
+    }                                                                               \
+    args->diff = diff;                                                              \
+    args->maxDiff = maxChange;                                                      \
+    args->danglingSum = danglingSum;                                                \
+}
 
-    Page pages[MAX_URLS];
-    int N = readCollection(pages, MAX_URLS);
-    calculatePageRank(pages, N, d, diffPR, maxIterations);
-    writePageRankToFile(pages, N);
+DEFINE_RANK_KERNEL(calculateNewRanks32DoubleDrop, uint32_t, double, 0, 0)
+DEFINE_RANK_KERNEL(calculateNewRanks32DoubleDropWeighted, uint32_t, double, 0, 1)
+DEFINE_RANK_KERNEL(calculateNewRanks32DoubleUniform, uint32_t, double, 1, 0)
+DEFINE_RANK_KERNEL(calculateNewRanks32DoubleUniformWeighted, uint32_t, double, 1, 1)
+DEFINE_RANK_KERNEL(calculateNewRanks32FloatDrop, uint32_t, float, 0, 0)
+DEFINE_RANK_KERNEL(calculateNewRanks32FloatDropWeighted, uint32_t, float, 0, 1)
+DEFINE_RANK_KERNEL(calculateNewRanks32FloatUniform, uint32_t, float, 1, 0)
+DEFINE_RANK_KERNEL(calculateNewRanks32FloatUniformWeighted, uint32_t, float, 1, 1)
+DEFINE_RANK_KERNEL(calculateNewRanks64DoubleDrop, uint64_t, double, 0, 0)
+DEFINE_RANK_KERNEL(calculateNewRanks64DoubleDropWeighted, uint64_t, double, 0, 1)
+DEFINE_RANK_KERNEL(calculateNewRanks64DoubleUniform, uint64_t, double, 1, 0)
+DEFINE_RANK_KERNEL(calculateNewRanks64DoubleUniformWeighted, uint64_t, double, 1, 1)
+DEFINE_RANK_KERNEL(calculateNewRanks64FloatDrop, uint64_t, float, 0, 0)
+DEFINE_RANK_KERNEL(calculateNewRanks64FloatDropWeighted, uint64_t, float, 0, 1)
+DEFINE_RANK_KERNEL(calculateNewRanks64FloatUniform, uint64_t, float, 1, 0)
+DEFINE_RANK_KERNEL(calculateNewRanks64FloatUniformWeighted, uint64_t, float, 1, 1)
 
+// Stream VByte shuffle masks and data lengths for every control byte
+unsigned char vbyteShuffle[256][16];
+unsigned char vbyteLength[256];
+
+void initStreamVByte(void) {
+    for (int c = 0; c < 256; c++) {
+        int offset = 0;
+        for (int k = 0; k < 4; k++) {
+            int length = ((c >> (2 * k)) & 3) + 1;
+            for (int b = 0; b < 4; b++) {
+                vbyteShuffle[c][4 * k + b] = b < length ? offset + b : 0x80;
+            }
+            offset += length;
+        }
+        vbyteLength[c] = offset;
+    }
+}
+
+// Function to Stream VByte encode the gaps of an ascending list. Returns
+// the number of bytes used; when out is NULL nothing is written.
+long encodeStreamVByte(const uint32_t values[], long count, unsigned char *out) {
+    long controlBytes = (count + 3) / 4;
+    long length = controlBytes;
+    uint32_t prev = 0;
+
+    if (out) {
+        memset(out, 0, controlBytes);
+    }
+    for (long k = 0; k < count; k++) {
+        uint32_t gap = values[k] - prev;
+        prev = values[k];
+        int bytes = gap < (1u << 8) ? 1 : gap < (1u << 16) ? 2 : gap < (1u << 24) ? 3 : 4;
+        if (out) {
+            out[k / 4] |= (bytes - 1) << (2 * (k % 4));
+            for (int b = 0; b < bytes; b++) {
+                out[length + b] = gap >> (8 * b);
+            }
+        }
+        length += bytes;
+    }
+    return length;
+}
+
+// Function to replace the incoming-link lists of a graph by their Stream
+// VByte encoded gaps
+void compressGraph(Graph *graph) {
+    const uint32_t *sources = graph->inSources;
+    initStreamVByte();
+
+    graph->inByteOffsets = malloc((graph->N + 1) * sizeof(long));
+    if (!graph->inByteOffsets) {
+        perror("Error allocating compressed graph");
+        exit(1);
+    }
+    graph->inByteOffsets[0] = 0;
+    for (int i = 0; i < graph->N; i++) {
+        long count = graph->inOffsets[i + 1] - graph->inOffsets[i];
+        graph->inByteOffsets[i + 1] = graph->inByteOffsets[i] +
+            encodeStreamVByte(sources + graph->inOffsets[i], count, NULL);
+    }
+
+    graph->inBytes = calloc(graph->inByteOffsets[graph->N] + VBYTE_PADDING, 1);
+    if (!graph->inBytes) {
+        perror("Error allocating compressed graph");
+        exit(1);
+    }
+    for (int i = 0; i < graph->N; i++) {
+        long count = graph->inOffsets[i + 1] - graph->inOffsets[i];
+        encodeStreamVByte(sources + graph->inOffsets[i], count,
+                          graph->inBytes + graph->inByteOffsets[i]);
+    }
+
+    free(graph->inSources);
+    graph->inSources = NULL;
+}
+
+// Function template computing new ranks like DEFINE_RANK_KERNEL, decoding
+// the compressed incoming-link lists on the fly. With SSSE3 four gaps are
+// decoded at once by a byte shuffle followed by an in-register prefix sum;
+// the remaining gaps of each list are decoded one by one. Decoded ids are
+// always 32 bits wide, so only the rank type and dangling policy vary.
+#ifdef __SSSE3__
+#define DECODE_STREAM_VBYTE_QUADS                                                   \
+        __m128i last = _mm_setzero_si128();                                         \
+        for (; k + 4 <= count; k += 4) {                                            \
+            unsigned c = control[k / 4];                                            \
+            __m128i v = _mm_loadu_si128((const __m128i *)data);                     \
+            v = _mm_shuffle_epi8(v, _mm_loadu_si128((const __m128i *)vbyteShuffle[c])); \
+            v = _mm_add_epi32(v, _mm_slli_si128(v, 4));                             \
+            v = _mm_add_epi32(v, _mm_slli_si128(v, 8));                             \
+            v = _mm_add_epi32(v, last);                                             \
+            last = _mm_shuffle_epi32(v, 0xFF);                                      \
+            data += vbyteLength[c];                                                 \
+                                                                                    \
+            uint32_t sources[4];                                                    \
+            _mm_storeu_si128((__m128i *)sources, v);                                \
+            sum += contrib[sources[0]];                                             \
+            sum += contrib[sources[1]];                                             \
+            sum += contrib[sources[2]];                                             \
+            sum += contrib[sources[3]];                                             \
+        }                                                                           \
+        source = _mm_cvtsi128_si32(last);
+#else
+#define DECODE_STREAM_VBYTE_QUADS
+#endif
+
+#define DEFINE_COMPRESSED_RANK_KERNEL(NAME, RANK_TYPE, UNIFORM_DANGLING)              \
+void NAME(KernelArgs *args) {                                                       \
+    const Graph *graph = args->graph;                                               \
+    const RANK_TYPE *contrib = args->contrib;                                       \
+    RANK_TYPE *nextContrib = args->nextContrib;                                     \
+    double *pageRank = args->pageRank;                                              \
+    int N = graph->N;                                                               \
+    double d = args->d;                                                             \
+    double danglingShare = args->danglingRank / N;                                  \
+    double diff = 0.0;                                                              \
+    double maxChange = 0.0;                                                         \
+    double danglingSum = 0.0;                                                       \
+                                                                                    \
+    for (int i = args->lo; i < args->hi; i++) {                                     \
+        long count = graph->inOffsets[i + 1] - graph->inOffsets[i];                 \
+        const unsigned char *control = graph->inBytes + graph->inByteOffsets[i];    \
+        const unsigned char *data = control + (count + 3) / 4;                      \
+        uint32_t source = 0;                                                        \
+        double sum = 0.0;                                                           \
+        long k = 0;                                                                 \
+                                                                                    \
+        DECODE_STREAM_VBYTE_QUADS                                                   \
+        for (; k < count; k++) {                                                    \
+            int bytes = ((control[k / 4] >> (2 * (k % 4))) & 3) + 1;                \
+            uint32_t gap = 0;                                                       \
+            for (int b = 0; b < bytes; b++) {                                       \
+                gap |= (uint32_t)data[b] << (8 * b);                                \
+            }                                                                       \
+            data += bytes;                                                          \
+            source += gap;                                                          \
+            sum += contrib[source];                                                 \
+        }                                                                           \
+        if (UNIFORM_DANGLING) {                                                     \
+            sum += danglingShare;                                                   \
+        }                                                                           \
+                                                                                    \
+        double newRank = ((1 - d) / N) + (d * sum);                                 \
+        double change = fabs(newRank - pageRank[i]);                                \
+        diff += change;                                                             \
+        if (change > maxChange) {                                                   \
+            maxChange = change;                                                     \
+        }                                                                           \
+        pageRank[i] = newRank;                                                      \
+        if (graph->outDegree[i] != 0) {                                             \
+            nextContrib[i] = (RANK_TYPE)(newRank / graph->outDegree[i]);            \
+        } else {                                                                    \
+            nextContrib[i] = 0;                                                     \
+            if (UNIFORM_DANGLING) {                                                 \
+                danglingSum += newRank;                                             \
+            }                                                                       \
+        }                                                                           \
+    }                                                                               \
+    args->diff = diff;                                                              \
+    args->maxDiff = maxChange;                                                      \
+    args->danglingSum = danglingSum;                                                \
+}
+
+DEFINE_COMPRESSED_RANK_KERNEL(calculateNewRanksCompressedDoubleDrop, double, 0)
+DEFINE_COMPRESSED_RANK_KERNEL(calculateNewRanksCompressedDoubleUniform, double, 1)
+DEFINE_COMPRESSED_RANK_KERNEL(calculateNewRanksCompressedFloatDrop, float, 0)
+DEFINE_COMPRESSED_RANK_KERNEL(calculateNewRanksCompressedFloatUniform, float, 1)
+
+// Instantiations indexed by [64-bit ids][float ranks][uniform dangling][weighted]
+RankKernel plainKernels[2][2][2][2] = {
+    { { { calculateNewRanks32DoubleDrop, calculateNewRanks32DoubleDropWeighted },
+        { calculateNewRanks32DoubleUniform, calculateNewRanks32DoubleUniformWeighted } },
+      { { calculateNewRanks32FloatDrop, calculateNewRanks32FloatDropWeighted },
+        { calculateNewRanks32FloatUniform, calculateNewRanks32FloatUniformWeighted } } },
+    { { { calculateNewRanks64DoubleDrop, calculateNewRanks64DoubleDropWeighted },
+        { calculateNewRanks64DoubleUniform, calculateNewRanks64DoubleUniformWeighted } },
+      { { calculateNewRanks64FloatDrop, calculateNewRanks64FloatDropWeighted },
+        { calculateNewRanks64FloatUniform, calculateNewRanks64FloatUniformWeighted } } }
+};
+
+// Instantiations indexed by [float ranks][uniform dangling]
+RankKernel compressedKernels[2][2] = {
+    { calculateNewRanksCompressedDoubleDrop, calculateNewRanksCompressedDoubleUniform },
+    { calculateNewRanksCompressedFloatDrop, calculateNewRanksCompressedFloatUniform }
+};
+
+// Function to pick the kernel instantiation for a graph. Unless indexWidth
+// forces one, the narrowest vertex id that can address every page is used;
+// the id width in bytes is stored in indexBytes. Compressed graphs decode
+// 32-bit ids whatever the width. Graphs with inWeights get a weighted
+// instantiation.
+RankKernel selectRankKernel(const Graph *graph, int rankType, int dangling, int indexWidth,
+                            int *indexBytes) {
+    int wide = indexWidth == 64 ||
+               (indexWidth != 32 && (uint64_t)graph->N > UINT32_MAX);
+    int useFloat = rankType == RANK_FLOAT;
+    int uniform = dangling == DANGLING_UNIFORM;
+
+    if (graph->inBytes) {
+        *indexBytes = sizeof(uint32_t);
+        return compressedKernels[useFloat][uniform];
+    }
+    *indexBytes = wide ? sizeof(uint64_t) : sizeof(uint32_t);
+    return plainKernels[wide][useFloat][uniform][graph->inWeights != NULL];
+}
+
+// Function run by every thread of the rank iteration. The thread first
+// touches its slice of the graph and vectors so that they are placed on its
+// own NUMA node, then iterates over its pages until the engine is done.
+void *runRankWorker(void *arg) {
+    RankWorker *worker = arg;
+    RankEngine *engine = worker->engine;
+    const Graph *staging = engine->staging;
+    Graph *graph = &engine->graph;
+    int lo = worker->lo;
+    int hi = worker->hi;
+
+    if (engine->pinThreads && worker->cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(worker->cpu, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+
+    for (int i = lo; i < hi; i++) {
+        engine->pageRank[i] = engine->pages[i].pageRank;
+        graph->inOffsets[i + 1] = staging->inOffsets[i + 1];
+        graph->outDegree[i] = staging->outDegree[i];
+        double outWeight = graph->outDegree[i];
+        if (staging->outWeight) {
+            graph->outWeight[i] = staging->outWeight[i];
+            outWeight = graph->outWeight[i];
+        }
+        double contrib = outWeight != 0 ? engine->pageRank[i] / outWeight : 0.0;
+        if (engine->rankBytes == sizeof(float)) {
+            ((float *)engine->nextContrib)[i] = 0.0f;
+            ((float *)engine->contrib)[i] = (float)contrib;
+        } else {
+            ((double *)engine->nextContrib)[i] = 0.0;
+            ((double *)engine->contrib)[i] = contrib;
+        }
+    }
+    long edges = staging->inOffsets[hi] - staging->inOffsets[lo];
+    if (staging->inBytes) {
+        for (int i = lo; i < hi; i++) {
+            graph->inByteOffsets[i + 1] = staging->inByteOffsets[i + 1];
+        }
+        memcpy(graph->inBytes + staging->inByteOffsets[lo],
+               staging->inBytes + staging->inByteOffsets[lo],
+               staging->inByteOffsets[hi] - staging->inByteOffsets[lo]);
+    } else if (graph->indexBytes == sizeof(uint64_t)) {
+        const uint32_t *sources = staging->inSources;
+        uint64_t *wideSources = graph->inSources;
+        for (long e = staging->inOffsets[lo]; e < staging->inOffsets[hi]; e++) {
+            wideSources[e] = sources[e];
+        }
+    } else {
+        memcpy((uint32_t *)graph->inSources + staging->inOffsets[lo],
+               (const uint32_t *)staging->inSources + staging->inOffsets[lo],
+               edges * sizeof(uint32_t));
+    }
+    if (staging->inWeights) {
+        const double *weights = staging->inWeights;
+        for (long e = staging->inOffsets[lo]; e < staging->inOffsets[hi]; e++) {
+            if (engine->rankBytes == sizeof(float)) {
+                ((float *)graph->inWeights)[e] = (float)weights[e];
+            } else {
+                ((double *)graph->inWeights)[e] = weights[e];
+            }
+        }
+    }
+    PerfCounters *counters = worker->counters;
+    if (counters) {
+        openPerfCounters(counters);
+    }
+    pthread_barrier_wait(&engine->barrier);
+
+    if (worker->id == 0) {
+        endPhase(engine->telemetry, "build");
+        beginPhase(engine->telemetry);
+        engine->iterationStart = wallSeconds();
+    }
+
+    // Under the steal schedule the bytes follow the tasks actually run
+    RankTask slice = { lo, hi, 0, 0, -1 };
+    double bytesPerIteration = rankTaskBytes(engine, &slice);
+
+    if (counters) {
+        samplePerfCounters(counters, -1);
+    }
+
+    KernelArgs args;
+    memset(&args, 0, sizeof(args));
+    args.graph = graph;
+    args.pageRank = engine->pageRank;
+    args.lo = lo;
+    args.hi = hi;
+    args.d = engine->d;
+
+    for (;;) {
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        args.contrib = engine->contrib;
+        args.nextContrib = engine->nextContrib;
+        args.danglingRank = engine->danglingRank;
+        if (engine->tasks) {
+            worker->residual = 0.0;
+            worker->maxResidual = 0.0;
+            worker->danglingSum = 0.0;
+            RankTask *task;
+            while ((task = nextRankTask(engine, worker)) != NULL) {
+                worker->bytes += rankTaskBytes(engine, task);
+                if (engine->blockSize > 0) {
+                    runRankBlocks(engine, &args, task->lo, task->hi);
+                    continue;
+                }
+                if (task->slot >= 0) {
+                    engine->partialSums[task->slot] =
+                        partialInSum(graph, args.contrib, engine->rankBytes,
+                                     task->edgeLo, task->edgeHi);
+                    continue;
+                }
+                args.lo = task->lo;
+                args.hi = task->hi;
+                engine->kernel(&args);
+                worker->residual += args.diff;
+                if (args.maxDiff > worker->maxResidual) {
+                    worker->maxResidual = args.maxDiff;
+                }
+                worker->danglingSum += args.danglingSum;
+            }
+        } else if (engine->blockSize > 0) {
+            runRankBlocks(engine, &args, lo, hi);
+        } else {
+            engine->kernel(&args);
+            worker->residual = args.diff;
+            worker->maxResidual = args.maxDiff;
+            worker->danglingSum = args.danglingSum;
+        }
+        worker->seconds += elapsedSeconds(&start);
+        if (!engine->tasks) {
+            worker->bytes += bytesPerIteration;
+        }
+        if (counters) {
+            samplePerfCounters(counters, PERF_PHASE_KERNEL);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        pthread_barrier_wait(&engine->barrier);
+        worker->idleSeconds += elapsedSeconds(&start);
+        if (counters) {
+            samplePerfCounters(counters, PERF_PHASE_BARRIER);
+        }
+
+        if (worker->id == 0) {
+            double diff = 0.0;
+            double maxDiff = 0.0;
+            double danglingRank = 0.0;
+            if (engine->tasks) {
+                finishSplitPages(engine, &diff, &maxDiff, &danglingRank);
+                for (int t = 0; t < engine->numThreads; t++) {
+                    engine->deques[t].head = engine->deques[t].first;
+                    engine->deques[t].tail = engine->deques[t].last;
+                }
+            }
+            if (engine->blockSize > 0) {
+                diff = pairwiseSum(engine->blockDiff, engine->numBlocks);
+                danglingRank = pairwiseSum(engine->blockDangling, engine->numBlocks);
+                for (int b = 0; b < engine->numBlocks; b++) {
+                    if (engine->blockMaxDiff[b] > maxDiff) {
+                        maxDiff = engine->blockMaxDiff[b];
+                    }
+                }
+            }
+            for (int t = 0; t < engine->numThreads && engine->blockSize == 0; t++) {
+                diff += engine->workers[t].residual;
+                if (engine->workers[t].maxResidual > maxDiff) {
+                    maxDiff = engine->workers[t].maxResidual;
+                }
+                danglingRank += engine->workers[t].danglingSum;
+            }
+            engine->danglingRank = danglingRank;
+            void *tmp = engine->contrib;
+            engine->contrib = engine->nextContrib;
+            engine->nextContrib = tmp;
+            engine->iteration++;
+
+            double now = wallSeconds();
+            recordIteration(engine->telemetry, engine->iteration, diff, maxDiff,
+                            now - engine->iterationStart);
+            engine->iterationStart = now;
+            engine->done = !(engine->iteration < engine->maxIterations && diff >= engine->diffPR);
+            engine->lastResidual = engine->residual;
+            engine->residual = diff;
+
+            // The iteration is a contraction by d in L1, so every rank is
+            // within d / (1 - d) times the last change of its fixed point
+            if (engine->topK > 0 && !engine->done) {
+                double error = engine->d / (1 - engine->d) * diff;
+                engine->certifiedK = certifyTopK(engine->pageRank, engine->graph.N,
+                                                 engine->topK, error, engine->topPages);
+                if (engine->certifiedK >= engine->topK) {
+                    engine->done = 1;
+                    engine->stoppedEarly = 1;
+                }
+            }
+
+            if (engine->checkpointer && !engine->done &&
+                engine->iteration % engine->checkpointEvery == 0) {
+                engine->checkpointHeader.iteration = engine->iteration;
+                requestCheckpoint(engine->checkpointer, &engine->checkpointHeader,
+                                  engine->pageRank);
+            }
+        }
+        if (counters) {
+            samplePerfCounters(counters, PERF_PHASE_REDUCE);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        pthread_barrier_wait(&engine->barrier);
+        worker->idleSeconds += elapsedSeconds(&start);
+        if (counters) {
+            samplePerfCounters(counters, PERF_PHASE_BARRIER);
+        }
+
+        if (engine->done) {
+            break;
+        }
+    }
+
+    if (counters) {
+        closePerfCounters(counters);
+    }
+    return NULL;
+}
+
+// Function to open the hardware counters of the calling thread as one
+// event group, so that they are scheduled on the PMU together. The cycle
+// counter leads the group; other events the CPU does not support are left
+// out. Only user-space events are counted.
+void openPerfCounters(PerfCounters *counters) {
+    static const struct {
+        uint32_t type;
+        uint64_t config;
+    } events[NUM_COUNTERS] = {
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+        { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL |
+                              (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                              (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+        { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB |
+                              (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                              (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+    };
+
+    memset(counters, 0, sizeof(*counters));
+    counters->leader = -1;
+    for (int c = 0; c < NUM_COUNTERS; c++) {
+        counters->fds[c] = -1;
+        counters->index[c] = -1;
+
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = events[c].type;
+        attr.config = events[c].config;
+        attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                           PERF_FORMAT_TOTAL_TIME_RUNNING;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.disabled = c == COUNTER_CYCLES;
+
+        int fd = syscall(SYS_perf_event_open, &attr, 0, -1, counters->leader, 0);
+        if (fd < 0) {
+            if (c == COUNTER_CYCLES) {
+                counters->error = errno;
+                return;
+            }
+            continue;
+        }
+        if (c == COUNTER_CYCLES) {
+            counters->leader = fd;
+        }
+        counters->fds[c] = fd;
+        counters->index[c] = counters->numOpen++;
+    }
+    ioctl(counters->leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+// Function to read the counters and charge their increase since the last
+// sample to a phase. A negative phase only takes the starting values.
+void samplePerfCounters(PerfCounters *counters, int phase) {
+    if (counters->leader < 0) {
+        return;
+    }
+
+    // The group reads as its size, the times enabled and running, then the
+    // counts. A multiplexed group only counted while running, so its counts
+    // are scaled up to the whole time enabled.
+    uint64_t values[3 + NUM_COUNTERS];
+    if (read(counters->leader, values, sizeof(values)) < (ssize_t)(3 * sizeof(uint64_t))) {
+        return;
+    }
+    uint64_t enabled = values[1];
+    uint64_t running = values[2];
+    if (running == 0) {
+        return;
+    }
+    if (running < enabled) {
+        counters->multiplexed = 1;
+    }
+    for (int c = 0; c < NUM_COUNTERS; c++) {
+        if (counters->index[c] < 0) {
+            continue;
+        }
+        uint64_t value = values[3 + counters->index[c]];
+        if (running < enabled) {
+            value = (uint64_t)((double)value * enabled / running);
+        }
+        // Rescaling can move an estimate back a little; it is never counted twice
+        if (value <= counters->last[c]) {
+            continue;
+        }
+        if (phase >= 0) {
+            counters->totals[phase][c] += value - counters->last[c];
+        }
+        counters->last[c] = value;
+    }
+}
+
+void closePerfCounters(PerfCounters *counters) {
+    for (int c = 0; c < NUM_COUNTERS; c++) {
+        if (counters->fds[c] >= 0) {
+            close(counters->fds[c]);
+        }
+    }
+}
+
+// Function to report the counters of every phase summed over the threads,
+// with IPC and events per edge processed
+void reportPerfCounters(RankEngine *engine) {
+    static const char *phaseNames[NUM_PERF_PHASES] = { "kernel", "barrier", "reduce" };
+    static const char *counterNames[NUM_COUNTERS] = {
+        "cycles", "instructions", "LLC misses", "dTLB misses", "branch misses"
+    };
+
+    int available[NUM_COUNTERS] = { 0 };
+    int multiplexed = 0;
+    for (int t = 0; t < engine->numThreads; t++) {
+        for (int c = 0; c < NUM_COUNTERS; c++) {
+            available[c] |= engine->workers[t].counters->index[c] >= 0;
+        }
+        multiplexed |= engine->workers[t].counters->multiplexed;
+    }
+    if (!available[COUNTER_CYCLES]) {
+        fprintf(stderr, "perf counters unavailable: %s\n",
+                strerror(engine->workers[0].counters->error));
+        return;
+    }
+
+    double edges = (double)engine->graph.numEdges * engine->iteration;
+    fprintf(stderr, "perf counters over %d iterations, %.0f edges:\n",
+            engine->iteration, edges);
+    for (int phase = 0; phase < NUM_PERF_PHASES; phase++) {
+        uint64_t totals[NUM_COUNTERS] = { 0 };
+        for (int t = 0; t < engine->numThreads; t++) {
+            for (int c = 0; c < NUM_COUNTERS; c++) {
+                totals[c] += engine->workers[t].counters->totals[phase][c];
+            }
+        }
+
+        fprintf(stderr, "  %-8s", phaseNames[phase]);
+        if (available[COUNTER_INSTRUCTIONS] && totals[COUNTER_CYCLES] > 0) {
+            fprintf(stderr, " IPC %.2f", (double)totals[COUNTER_INSTRUCTIONS] /
+                                         totals[COUNTER_CYCLES]);
+        }
+        for (int c = 0; c < NUM_COUNTERS; c++) {
+            if (!available[c]) {
+                continue;
+            }
+            fprintf(stderr, ", %s %llu", counterNames[c], (unsigned long long)totals[c]);
+            if (phase == PERF_PHASE_KERNEL && edges > 0) {
+                fprintf(stderr, " (%.3f/edge)", totals[c] / edges);
+            }
+        }
+        fprintf(stderr, "\n");
+    }
+    if (multiplexed) {
+        fprintf(stderr, "  counters were multiplexed; counts are scaled estimates\n");
+    }
+}
+
+// Function to hash the URLs, out-degrees and incoming links of a graph with
+// FNV-1a, so that a checkpoint is only resumed against the same snapshot
+uint64_t fingerprintGraph(Page pages[], const Graph *graph) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (int i = 0; i < graph->N; i++) {
+        const unsigned char *url = (const unsigned char *)pages[i].url;
+        for (size_t k = 0; k <= strlen(pages[i].url); k++) {
+            hash = (hash ^ url[k]) * 1099511628211ULL;
+        }
+        uint64_t values[2] = { (uint64_t)graph->outDegree[i],
+                               (uint64_t)graph->inOffsets[i + 1] };
+        const unsigned char *bytes = (const unsigned char *)values;
+        for (size_t k = 0; k < sizeof(values); k++) {
+            hash = (hash ^ bytes[k]) * 1099511628211ULL;
+        }
+    }
+    const unsigned char *sources = (const unsigned char *)graph->inSources;
+    for (size_t k = 0; k < (size_t)graph->numEdges * graph->indexBytes; k++) {
+        hash = (hash ^ sources[k]) * 1099511628211ULL;
+    }
+    const unsigned char *weights = graph->inWeights;
+    for (size_t k = 0; weights && k < graph->numEdges * sizeof(double); k++) {
+        hash = (hash ^ weights[k]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Function to restore the rank vector from a checkpoint. Returns the
+// checkpointed iteration, or -1 if there is no checkpoint to resume. A
+// checkpoint of a different graph or damping factor is an error.
+int readCheckpoint(const char *path, const CheckpointHeader *expected, double pageRank[]) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        fprintf(stderr, "No checkpoint at %s, starting from scratch\n", path);
+        return -1;
+    }
+
+    CheckpointHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+        memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != CHECKPOINT_VERSION) {
+        fprintf(stderr, "Error: %s is not a valid checkpoint\n", path);
+        exit(1);
+    }
+    if (header.fingerprint != expected->fingerprint ||
+        header.numPages != expected->numPages || header.numEdges != expected->numEdges) {
+        fprintf(stderr, "Error: %s was written for a different graph\n", path);
+        exit(1);
+    }
+    if (header.d != expected->d) {
+        fprintf(stderr, "Error: %s was written with d = %g\n", path, header.d);
+        exit(1);
+    }
+    if (fread(pageRank, sizeof(double), header.numPages, file) != header.numPages) {
+        fprintf(stderr, "Error: %s is truncated\n", path);
+        exit(1);
+    }
+    fclose(file);
+    return header.iteration;
+}
+
+// Function run by the checkpoint thread. Each snapshot is written to a
+// temporary file, synced and renamed over the checkpoint, so a crash at
+// any point leaves the previous checkpoint intact.
+void *runCheckpointer(void *arg) {
+    Checkpointer *checkpointer = arg;
+    size_t tmpLength = strlen(checkpointer->path) + 5;
+    char *tmpPath = malloc(tmpLength);
+    if (!tmpPath) {
+        perror("Error allocating checkpoint path");
+        exit(1);
+    }
+    snprintf(tmpPath, tmpLength, "%s.tmp", checkpointer->path);
+
+    pthread_mutex_lock(&checkpointer->lock);
+    for (;;) {
+        while (!checkpointer->pending && !checkpointer->stop) {
+            pthread_cond_wait(&checkpointer->wake, &checkpointer->lock);
+        }
+        if (!checkpointer->pending) {
+            break;
+        }
+        checkpointer->pending = 0;
+        pthread_mutex_unlock(&checkpointer->lock);
+
+        int ok = 0;
+        FILE *file = fopen(tmpPath, "wb");
+        if (file) {
+            ok = fwrite(&checkpointer->header, sizeof(CheckpointHeader), 1, file) == 1 &&
+                 fwrite(checkpointer->snapshot, sizeof(double),
+                        checkpointer->header.numPages, file) == checkpointer->header.numPages &&
+                 fflush(file) == 0 && fsync(fileno(file)) == 0;
+            ok = fclose(file) == 0 && ok;
+        }
+        if (ok && rename(tmpPath, checkpointer->path) == 0) {
+            checkpointer->written++;
+        } else {
+            perror("Error writing checkpoint");
+            unlink(tmpPath);
+        }
+
+        pthread_mutex_lock(&checkpointer->lock);
+        checkpointer->busy = 0;
+    }
+    pthread_mutex_unlock(&checkpointer->lock);
+
+    free(tmpPath);
+    return NULL;
+}
+
+void startCheckpointer(Checkpointer *checkpointer, const char *path, int N) {
+    memset(checkpointer, 0, sizeof(*checkpointer));
+    checkpointer->path = path;
+    checkpointer->snapshot = malloc((N > 0 ? N : 1) * sizeof(double));
+    if (!checkpointer->snapshot) {
+        perror("Error allocating checkpoint buffer");
+        exit(1);
+    }
+    pthread_mutex_init(&checkpointer->lock, NULL);
+    pthread_cond_init(&checkpointer->wake, NULL);
+    if (pthread_create(&checkpointer->thread, NULL, runCheckpointer, checkpointer) != 0) {
+        perror("Error creating checkpoint thread");
+        exit(1);
+    }
+}
+
+// Function to hand a snapshot of the ranks to the checkpoint thread. Only
+// the copy is done on the caller's thread; if a checkpoint is still being
+// written this one is skipped.
+void requestCheckpoint(Checkpointer *checkpointer, const CheckpointHeader *header,
+                       const double pageRank[]) {
+    pthread_mutex_lock(&checkpointer->lock);
+    if (checkpointer->busy) {
+        checkpointer->skipped++;
+    } else {
+        checkpointer->header = *header;
+        memcpy(checkpointer->snapshot, pageRank, header->numPages * sizeof(double));
+        checkpointer->pending = 1;
+        checkpointer->busy = 1;
+        pthread_cond_signal(&checkpointer->wake);
+    }
+    pthread_mutex_unlock(&checkpointer->lock);
+}
+
+// Function to wait for the checkpoint being written, if any, and stop the
+// checkpoint thread
+void stopCheckpointer(Checkpointer *checkpointer) {
+    pthread_mutex_lock(&checkpointer->lock);
+    checkpointer->stop = 1;
+    pthread_cond_signal(&checkpointer->wake);
+    pthread_mutex_unlock(&checkpointer->lock);
+    pthread_join(checkpointer->thread, NULL);
+
+    pthread_mutex_destroy(&checkpointer->lock);
+    pthread_cond_destroy(&checkpointer->wake);
+    free(checkpointer->snapshot);
+}
+
+// Function to report the memory bandwidth achieved by the threads of each
+// NUMA node
+void reportNodeBandwidth(RankEngine *engine) {
+    int maxNode = -1;
+    for (int t = 0; t < engine->numThreads; t++) {
+        if (engine->workers[t].node > maxNode) {
+            maxNode = engine->workers[t].node;
+        }
+    }
+
+    fprintf(stderr, "iterations: %d\n", engine->iteration);
+    for (int node = -1; node <= maxNode; node++) {
+        int threads = 0;
+        double bytes = 0.0;
+        double bandwidth = 0.0;
+        for (int t = 0; t < engine->numThreads; t++) {
+            RankWorker *worker = &engine->workers[t];
+            if (worker->node == node) {
+                threads++;
+                bytes += worker->bytes;
+                if (worker->seconds > 0) {
+                    bandwidth += worker->bytes / worker->seconds;
+                }
+            }
+        }
+        if (threads > 0) {
+            fprintf(stderr, "node %d: %d threads, %.1f MB streamed, %.2f GB/s\n",
+                    node, threads, bytes / 1e6, bandwidth / 1e9);
+        }
+    }
+}
+
+// Function to count the leading pages of the ranking whose identity and
+// order are certain when every rank is within error of its final value:
+// the top j are certain while each of the top j + 1 pages leads the next by
+// more than 2 * error. Looks at most k pages deep; top[] must hold k + 1.
+int certifyTopK(const double pageRank[], int N, int k, double error, int top[]) {
+    int count = 0;
+    for (int i = 0; i < N; i++) {
+        if (count == k + 1 && pageRank[i] <= pageRank[top[k]]) {
+            continue;
+        }
+        int m = count < k + 1 ? count++ : k;
+        while (m > 0 && pageRank[top[m - 1]] < pageRank[i]) {
+            top[m] = top[m - 1];
+            m--;
+        }
+        top[m] = i;
+    }
+
+    int certified = 0;
+    while (certified < k && certified + 1 < count &&
+           pageRank[top[certified]] - pageRank[top[certified + 1]] > 2 * error) {
+        certified++;
+    }
+    if (certified == count - 1 && count <= k) {
+        certified = count;      // fewer pages than k: the last one is certain too
+    }
+    return certified;
+}
+
+// Function to report on stderr how many of the top pages were certified
+// and, after an early stop, roughly how many iterations the L1 criterion
+// would still have needed, extrapolated from the last residual decay
+void reportTopK(RankEngine *engine) {
+    if (!engine->stoppedEarly) {
+        double error = engine->d / (1 - engine->d) * engine->residual;
+        engine->certifiedK = certifyTopK(engine->pageRank, engine->graph.N,
+                                         engine->topK, error, engine->topPages);
+        fprintf(stderr, "top-k: converged after %d iterations, top %d of %d certified\n",
+                engine->iteration, engine->certifiedK, engine->topK);
+        return;
+    }
+
+    double ratio = engine->lastResidual > 0 ? engine->residual / engine->lastResidual : 0.0;
+    if (ratio > 0 && ratio < 1) {
+        int saved = (int)ceil(log(engine->diffPR / engine->residual) / log(ratio));
+        if (engine->iteration + saved > engine->maxIterations) {
+            saved = engine->maxIterations - engine->iteration;
+        }
+        fprintf(stderr, "top-k: top %d certified after %d iterations, about %d iterations "
+                "saved\n", engine->certifiedK, engine->iteration, saved);
+    } else {
+        fprintf(stderr, "top-k: top %d certified after %d iterations\n",
+                engine->certifiedK, engine->iteration);
+    }
+}
+
+// Function to calculate PageRank with options->numThreads threads. Each
+// thread owns a contiguous range of pages, their incoming links and their
+// rank vector segments. With options->numa the threads are pinned to CPUs
+// spread over the NUMA nodes, and the per-node bandwidth is reported on
+// stderr. options->hugePages selects the huge page policy of the vectors.
+// The kernel is the instantiation for options->rankType and
+// options->dangling with the narrowest vertex id that fits the graph.
+// With options->weighted or options->linkWeights links are weighted, see
+// weightGraph. With options->topK the iteration stops as soon as the order
+// of the top options->topK pages is certain. With options->schedule set to
+// SCHEDULE_STEAL idle threads steal tasks from the others, see
+// buildRankTasks. options->deterministic reduces the residual and dangling
+// rank over fixed blocks of pages, making the results bit-identical across
+// thread counts; the rank of every page is already summed in link order.
+void calculatePageRank(Page pages[], int N, double d, double diffPR, int maxIterations,
+                       const RankOptions *options) {
+    int numThreads = options->numThreads;
+    int numa = options->numa;
+    if (numThreads < 1) {
+        numThreads = 1;
+    }
+    if (numThreads > N && N > 0) {
+        numThreads = N;
+    }
+
+    Telemetry *telemetry = options->telemetry;
+    beginPhase(telemetry);
+
+    Graph staging;
+    buildGraph(pages, N, &staging);
+    if (options->weighted || options->linkWeights) {
+        weightGraph(pages, &staging, options->linkWeights);
+    }
+    long plainBytes = staging.numEdges * sizeof(uint32_t);
+
+    CheckpointHeader checkpointHeader;
+    memset(&checkpointHeader, 0, sizeof(checkpointHeader));
+    int startIteration = 0;
+    if (options->checkpointPath) {
+        memcpy(checkpointHeader.magic, CHECKPOINT_MAGIC, sizeof(checkpointHeader.magic));
+        checkpointHeader.version = CHECKPOINT_VERSION;
+        checkpointHeader.fingerprint = fingerprintGraph(pages, &staging);
+        checkpointHeader.numPages = N;
+        checkpointHeader.numEdges = staging.numEdges;
+        checkpointHeader.d = d;
+        checkpointHeader.diffPR = diffPR;
+    }
+    if (options->checkpointPath && options->resume) {
+        double *restored = malloc((N > 0 ? N : 1) * sizeof(double));
+        if (!restored) {
+            perror("Error allocating checkpoint buffer");
+            exit(1);
+        }
+        int iteration = readCheckpoint(options->checkpointPath, &checkpointHeader, restored);
+        if (iteration >= 0) {
+            for (int i = 0; i < N; i++) {
+                pages[i].pageRank = restored[i];
+            }
+            startIteration = iteration;
+            fprintf(stderr, "Resuming from iteration %d\n", iteration);
+        }
+        free(restored);
+
+        // The iteration loop always runs once, so stop here if the saved run
+        // already did every iteration
+        if (iteration >= 0 && startIteration >= maxIterations) {
+            endPhase(telemetry, "build");
+            if (telemetry) {
+                telemetry->iterations = startIteration;
+                telemetry->edges = staging.numEdges;
+            }
+            freeGraph(&staging);
+            return;
+        }
+    }
+
+    if (options->compress) {
+        compressGraph(&staging);
+        long compressedBytes = staging.inByteOffsets[N] + (N + 1) * sizeof(long);
+        fprintf(stderr, "adjacency: %ld bytes plain, %ld bytes compressed (%.2fx)\n",
+                plainBytes, compressedBytes,
+                compressedBytes > 0 ? (double)plainBytes / compressedBytes : 0.0);
+    }
+
+    RankEngine engine;
+    memset(&engine, 0, sizeof(engine));
+    engine.staging = &staging;
+    engine.allocator.hugePages = options->hugePages;
+    engine.graph.N = N;
+    engine.graph.numEdges = staging.numEdges;
+    engine.graph.inOffsets = allocateVector(&engine.allocator, (N + 1) * sizeof(long));
+    if (options->compress) {
+        engine.graph.inByteOffsets = allocateVector(&engine.allocator, (N + 1) * sizeof(long));
+        engine.graph.inBytes = allocateVector(&engine.allocator,
+                                              staging.inByteOffsets[N] + VBYTE_PADDING);
+        engine.graph.inByteOffsets[0] = 0;
+    }
+    engine.kernel = selectRankKernel(&staging, options->rankType, options->dangling,
+                                     options->indexWidth, &engine.graph.indexBytes);
+    if (!options->compress) {
+        engine.graph.inSources = allocateVector(&engine.allocator,
+                                                staging.numEdges * engine.graph.indexBytes);
+    }
+    engine.rankBytes = options->rankType == RANK_FLOAT ? sizeof(float) : sizeof(double);
+    if (staging.inWeights) {
+        engine.graph.inWeights = allocateVector(&engine.allocator,
+                                                staging.numEdges * engine.rankBytes);
+        engine.graph.outWeight = allocateVector(&engine.allocator, N * sizeof(double));
+    }
+    engine.graph.outDegree = allocateVector(&engine.allocator, N * sizeof(int));
+    engine.pageRank = allocateVector(&engine.allocator, N * sizeof(double));
+    engine.contrib = allocateVector(&engine.allocator, N * engine.rankBytes);
+    engine.nextContrib = allocateVector(&engine.allocator, N * engine.rankBytes);
+    engine.d = d;
+    engine.diffPR = diffPR;
+    engine.maxIterations = maxIterations;
+    engine.numThreads = numThreads;
+    engine.pinThreads = numa;
+    engine.telemetry = telemetry;
+    engine.iteration = startIteration;
+    engine.graph.inOffsets[0] = 0;
+    if (options->topK > 0) {
+        engine.topK = options->topK < N ? options->topK : N;
+        engine.topPages = malloc((engine.topK + 1) * sizeof(int));
+        if (!engine.topPages) {
+            perror("Error allocating top-k pages");
+            exit(1);
+        }
+    }
+
+    Checkpointer checkpointer;
+    if (options->checkpointPath) {
+        startCheckpointer(&checkpointer, options->checkpointPath, N);
+        engine.checkpointer = &checkpointer;
+        engine.checkpointEvery = options->checkpointEvery > 0 ? options->checkpointEvery : 1;
+        engine.checkpointHeader = checkpointHeader;
+    }
+
+    engine.workers = calloc(numThreads, sizeof(RankWorker));
+    if (!engine.workers) {
+        perror("Error allocating rank workers");
+        exit(1);
+    }
+    PerfCounters *counters = NULL;
+    if (options->perfCounters) {
+        counters = calloc(numThreads, sizeof(PerfCounters));
+        if (!counters) {
+            perror("Error allocating perf counters");
+            exit(1);
+        }
+    }
+    for (int t = 0; t < numThreads; t++) {
+        engine.workers[t].engine = &engine;
+        engine.workers[t].id = t;
+        engine.workers[t].cpu = -1;
+        engine.workers[t].node = -1;
+        engine.workers[t].counters = counters ? &counters[t] : NULL;
+    }
+    partitionPages(&staging, engine.workers, numThreads);
+    if (options->deterministic) {
+        // Slices start at block boundaries, so every block is reduced by
+        // one thread in page order whatever the thread count
+        engine.blockSize = DETERMINISTIC_BLOCK;
+        engine.numBlocks = (N + engine.blockSize - 1) / engine.blockSize;
+        for (int t = 1; t < numThreads; t++) {
+            int boundary = (engine.workers[t].lo + engine.blockSize / 2) /
+                           engine.blockSize * engine.blockSize;
+            if (boundary > N) {
+                boundary = N;
+            }
+            engine.workers[t - 1].hi = boundary;
+            engine.workers[t].lo = boundary;
+        }
+        engine.blockDiff = calloc(engine.numBlocks + 1, sizeof(double));
+        engine.blockMaxDiff = calloc(engine.numBlocks + 1, sizeof(double));
+        engine.blockDangling = calloc(engine.numBlocks + 1, sizeof(double));
+        if (!engine.blockDiff || !engine.blockMaxDiff || !engine.blockDangling) {
+            perror("Error allocating reduction blocks");
+            exit(1);
+        }
+    }
+    engine.uniformDangling = options->dangling == DANGLING_UNIFORM;
+    engine.schedule = options->schedule;
+    if (options->schedule == SCHEDULE_STEAL) {
+        buildRankTasks(&engine);
+    }
+
+    // The ranks are written by the page owners during first touch
+    engine.pages = pages;
+    if (options->dangling == DANGLING_UNIFORM) {
+        for (int i = 0; i < N; i++) {
+            if (staging.outWeight ? staging.outWeight[i] == 0 : staging.outDegree[i] == 0) {
+                engine.danglingRank += pages[i].pageRank;
+            }
+        }
+    }
+
+    cpu_set_t savedAffinity;
+    if (numa) {
+        assignCpus(engine.workers, numThreads);
+        sched_getaffinity(0, sizeof(savedAffinity), &savedAffinity);
+    }
+
+    // The build phase ends once the workers have placed their slices
+    pthread_barrier_init(&engine.barrier, NULL, numThreads);
+    for (int t = 1; t < numThreads; t++) {
+        if (pthread_create(&engine.workers[t].thread, NULL, runRankWorker,
+                           &engine.workers[t]) != 0) {
+            perror("Error creating rank worker");
+            exit(1);
+        }
+    }
+    runRankWorker(&engine.workers[0]);
+    for (int t = 1; t < numThreads; t++) {
+        pthread_join(engine.workers[t].thread, NULL);
+    }
+    pthread_barrier_destroy(&engine.barrier);
+
+    if (options->checkpointPath) {
+        stopCheckpointer(&checkpointer);
+        if (checkpointer.skipped > 0) {
+            fprintf(stderr, "checkpoints: %d written, %d skipped while busy\n",
+                    checkpointer.written, checkpointer.skipped);
+        }
+    }
+
+    double iterateSeconds = endPhase(telemetry, "iterate");
+    if (telemetry) {
+        telemetry->iterations = engine.iteration;
+        telemetry->edges = staging.numEdges;
+        telemetry->iterateSeconds = iterateSeconds;
+    }
+
+    if (numa) {
+        sched_setaffinity(0, sizeof(savedAffinity), &savedAffinity);
+        reportNodeBandwidth(&engine);
+    }
+    if (options->hugePages != HUGE_PAGES_OFF) {
+        reportHugePages(&engine.allocator);
+    }
+    if (counters) {
+        reportPerfCounters(&engine);
+        free(counters);
+    }
+
+    if (engine.topK > 0) {
+        reportTopK(&engine);
+        free(engine.topPages);
+    }
+    if (engine.schedule != SCHEDULE_DEFAULT) {
+        reportSchedule(&engine);
+    }
+    free(engine.blockDiff);
+    free(engine.blockMaxDiff);
+    free(engine.blockDangling);
+    if (engine.tasks) {
+        for (int t = 0; t < numThreads; t++) {
+            pthread_mutex_destroy(&engine.deques[t].lock);
+        }
+        free(engine.tasks);
+        free(engine.deques);
+        free(engine.partialSums);
+        free(engine.splitPages);
+    }
+
+    for (int i = 0; i < N; i++) {
+        pages[i].pageRank = engine.pageRank[i];
+    }
+
+    free(engine.workers);
+    freeVectors(&engine.allocator);
+    freeGraph(&staging);
+}
+
+// Function to add to a double shared between threads without a lock
+void atomicAddDouble(double *target, double value) {
+    double old, sum;
+    __atomic_load(target, &old, __ATOMIC_RELAXED);
+    do {
+        sum = old + value;
+    } while (!__atomic_compare_exchange(target, &old, &sum, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+// Function run by every thread of the push-mode iteration. Each iteration
+// the thread scatters the contributions of its pages along their outgoing
+// links, then computes the new ranks of its pages from what was pushed to
+// them.
+//
+// With a frontier the sums persist across iterations and a page pushes
+// only the change of its contribution, and only once that change moves
+// more than the engine's threshold of rank. Pages below the threshold
+// keep their pending change for a later iteration.
+void *runPushWorker(void *arg) {
+    PushWorker *worker = arg;
+    PushEngine *engine = worker->engine;
+    int N = engine->N;
+    int lo = worker->lo;
+    int hi = worker->hi;
+    double *buffer = engine->buffers ? engine->buffers + (size_t)worker->id * N : NULL;
+
+    for (;;) {
+        // Scatter
+        for (int j = lo; j < hi; j++) {
+            if (engine->outDegree[j] == 0) {
+                continue;
+            }
+            double value = engine->pageRank[j] / engine->outDegree[j];
+            if (engine->frontier) {
+                double change = value - engine->pushed[j];
+                if (fabs(change) * engine->outDegree[j] <= engine->threshold) {
+                    continue;
+                }
+                engine->pushed[j] = value;
+                value = change;
+            }
+            for (long e = engine->outOffsets[j]; e < engine->outOffsets[j + 1]; e++) {
+                if (buffer) {
+                    buffer[engine->outTargets[e]] += value;
+                } else {
+                    atomicAddDouble(&engine->sums[engine->outTargets[e]], value);
+                }
+            }
+            worker->pushedEdges += engine->outOffsets[j + 1] - engine->outOffsets[j];
+        }
+        pthread_barrier_wait(&engine->barrier);
+
+        // Gather
+        double diff = 0.0;
+        double maxChange = 0.0;
+        for (int i = lo; i < hi; i++) {
+            double sum = engine->sums[i];
+            if (engine->buffers) {
+                for (int t = 0; t < engine->numThreads; t++) {
+                    sum += engine->buffers[(size_t)t * N + i];
+                    if (!engine->frontier) {
+                        engine->buffers[(size_t)t * N + i] = 0.0;
+                    }
+                }
+            }
+            if (!engine->frontier) {
+                engine->sums[i] = 0.0;
+            }
+            double newRank = ((1 - engine->d) / N) + (engine->d * sum);
+            double change = fabs(newRank - engine->pageRank[i]);
+            diff += change;
+            if (change > maxChange) {
+                maxChange = change;
+            }
+            engine->pageRank[i] = newRank;
+        }
+        worker->residual = diff;
+        worker->maxResidual = maxChange;
+        pthread_barrier_wait(&engine->barrier);
+
+        if (worker->id == 0) {
+            double diff = 0.0;
+            double maxDiff = 0.0;
+            for (int t = 0; t < engine->numThreads; t++) {
+                diff += engine->workers[t].residual;
+                if (engine->workers[t].maxResidual > maxDiff) {
+                    maxDiff = engine->workers[t].maxResidual;
+                }
+            }
+            engine->iteration++;
+            double now = wallSeconds();
+            recordIteration(engine->telemetry, engine->iteration, diff, maxDiff,
+                            now - engine->iterationStart);
+            engine->iterationStart = now;
+            engine->done = !(engine->iteration < engine->maxIterations && diff >= engine->diffPR);
+        }
+        pthread_barrier_wait(&engine->barrier);
+
+        if (engine->done) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+// Function to calculate PageRank in push mode on options->numThreads
+// threads, scattering along outgoing links instead of gathering along
+// incoming ones. options->push picks how concurrent pushes to one page are
+// combined; PUSH_AUTO uses per-thread buffers when the graph has at least
+// as many edges as the buffers have entries, since their combination then
+// costs less than the atomics it saves, and atomics otherwise.
+// options->frontier pushes only the pages whose rank changed.
+void calculatePageRankPush(Page pages[], int N, double d, double diffPR, int maxIterations,
+                           const RankOptions *options) {
+    int numThreads = options->numThreads;
+    if (numThreads < 1) {
+        numThreads = 1;
+    }
+    if (numThreads > N && N > 0) {
+        numThreads = N;
+    }
+    Telemetry *telemetry = options->telemetry;
+    beginPhase(telemetry);
+
+    PushEngine engine;
+    memset(&engine, 0, sizeof(engine));
+    engine.N = N;
+    engine.outOffsets = malloc((N + 1) * sizeof(long));
+    engine.outDegree = malloc((N > 0 ? N : 1) * sizeof(int));
+    engine.pageRank = malloc((N > 0 ? N : 1) * sizeof(double));
+    engine.sums = calloc(N > 0 ? N : 1, sizeof(double));
+    if (!engine.outOffsets || !engine.outDegree || !engine.pageRank || !engine.sums) {
+        perror("Error allocating push engine");
+        exit(1);
+    }
+    engine.outOffsets[0] = 0;
+    for (int j = 0; j < N; j++) {
+        for (int i = 0; i < N; i++) {
+            engine.numEdges += pages[j].links[i] != 0;
+        }
+        engine.outOffsets[j + 1] = engine.numEdges;
+        engine.outDegree[j] = pages[j].outDegree;
+        engine.pageRank[j] = pages[j].pageRank;
+    }
+    engine.outTargets = malloc((engine.numEdges > 0 ? engine.numEdges : 1) * sizeof(uint32_t));
+    if (!engine.outTargets) {
+        perror("Error allocating push engine");
+        exit(1);
+    }
+    long e = 0;
+    for (int j = 0; j < N; j++) {
+        for (int i = 0; i < N; i++) {
+            if (pages[j].links[i]) {
+                engine.outTargets[e++] = i;
+            }
+        }
+    }
+
+    int mode = options->push;
+    if (mode == PUSH_AUTO) {
+        mode = engine.numEdges >= (long)numThreads * N && numThreads > 1 ?
+               PUSH_BUFFERED : PUSH_ATOMIC;
+    }
+    if (mode == PUSH_BUFFERED) {
+        engine.buffers = calloc((size_t)numThreads * (N > 0 ? N : 1), sizeof(double));
+        if (!engine.buffers) {
+            perror("Error allocating push buffers");
+            exit(1);
+        }
+    }
+    engine.frontier = options->frontier;
+    if (engine.frontier) {
+        engine.pushed = calloc(N > 0 ? N : 1, sizeof(double));
+        if (!engine.pushed) {
+            perror("Error allocating push frontier");
+            exit(1);
+        }
+        // Changes left unpushed add up to at most diffPR over all pages
+        engine.threshold = N > 0 ? diffPR / N : 0.0;
+    }
+    engine.d = d;
+    engine.diffPR = diffPR;
+    engine.maxIterations = maxIterations;
+    engine.numThreads = numThreads;
+    engine.telemetry = telemetry;
+
+    engine.workers = calloc(numThreads, sizeof(PushWorker));
+    if (!engine.workers) {
+        perror("Error allocating push workers");
+        exit(1);
+    }
+    for (int t = 0; t < numThreads; t++) {
+        engine.workers[t].engine = &engine;
+        engine.workers[t].id = t;
+        engine.workers[t].lo = (long)N * t / numThreads;
+        engine.workers[t].hi = (long)N * (t + 1) / numThreads;
+    }
+    endPhase(telemetry, "build");
+
+    beginPhase(telemetry);
+    engine.iterationStart = wallSeconds();
+    if (N > 0) {
+        pthread_barrier_init(&engine.barrier, NULL, numThreads);
+        for (int t = 1; t < numThreads; t++) {
+            if (pthread_create(&engine.workers[t].thread, NULL, runPushWorker,
+                               &engine.workers[t]) != 0) {
+                perror("Error creating push worker");
+                exit(1);
+            }
+        }
+        runPushWorker(&engine.workers[0]);
+        for (int t = 1; t < numThreads; t++) {
+            pthread_join(engine.workers[t].thread, NULL);
+        }
+        pthread_barrier_destroy(&engine.barrier);
+    }
+    double iterateSeconds = endPhase(telemetry, "iterate");
+    if (telemetry) {
+        telemetry->iterations = engine.iteration;
+        telemetry->edges = engine.numEdges;
+        telemetry->iterateSeconds = iterateSeconds;
+    }
+
+    long pushedEdges = 0;
+    for (int t = 0; t < numThreads; t++) {
+        pushedEdges += engine.workers[t].pushedEdges;
+    }
+    double fullEdges = (double)engine.numEdges * engine.iteration;
+    fprintf(stderr, "push: %s accumulation, %d iterations, %ld edges pushed "
+            "(%.1f%% of full pushes)\n", mode == PUSH_BUFFERED ? "per-thread" : "atomic",
+            engine.iteration, pushedEdges, fullEdges > 0 ? 100.0 * pushedEdges / fullEdges : 0.0);
+
+    for (int i = 0; i < N; i++) {
+        pages[i].pageRank = engine.pageRank[i];
+    }
+    free(engine.workers);
+    free(engine.outOffsets);
+    free(engine.outTargets);
+    free(engine.outDegree);
+    free(engine.pageRank);
+    free(engine.sums);
+    free(engine.buffers);
+    free(engine.pushed);
+}
+
+void writePageRankToFile(Page pages[], int N, Telemetry *telemetry) {
+    FILE *file = fopen("pagerankList.txt", "w");
+    if (!file) {
+        perror("Error opening pagerankList.txt");
+        exit(1);
+    }
+
+    beginPhase(telemetry);
+    qsort(pages, N, sizeof(Page), comparePageRank);
+    endPhase(telemetry, "sort");
+
+    beginPhase(telemetry);
+    for (int i = 0; i < N; i++) {
+        fprintf(file, "%s, %d, %.7f\n", pages[i].url, pages[i].outDegree, pages[i].pageRank);
+    }
+    fclose(file);
+    endPhase(telemetry, "write");
+}
+
+// Function to write the parsed collection as a binary edge file
+void writeEdgeFile(Page pages[], int N, const char *path) {
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        perror("Error opening edge file");
+        exit(1);
+    }
+
+    EdgeFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, EDGE_FILE_MAGIC, sizeof(header.magic));
+    header.version = EDGE_FILE_VERSION;
+    header.numPages = N;
+    for (int i = 0; i < N; i++) {
+        for (int j = 0; j < N; j++) {
+            header.numEdges += pages[i].links[j] != 0;
+        }
+    }
+    header.urlTableOffset = sizeof(EdgeFileHeader) + N * sizeof(uint32_t) +
+                            header.numEdges * sizeof(Edge);
+    fwrite(&header, sizeof(header), 1, file);
+
+    for (int i = 0; i < N; i++) {
+        uint32_t outDegree = pages[i].outDegree;
+        fwrite(&outDegree, sizeof(outDegree), 1, file);
+    }
+
+    // Edges are written sorted by source, so every destination receives its
+    // contributions in the same order as the in-memory calculation
+    for (int i = 0; i < N; i++) {
+        for (int j = 0; j < N; j++) {
+            if (pages[i].links[j]) {
+                Edge edge = { (uint32_t)i, (uint32_t)j };
+                fwrite(&edge, sizeof(edge), 1, file);
+            }
+        }
+    }
+
+    for (int i = 0; i < N; i++) {
+        fwrite(pages[i].url, 1, strlen(pages[i].url) + 1, file);
+    }
+
+    if (ferror(file) || fclose(file) != 0) {
+        perror("Error writing edge file");
+        exit(1);
+    }
+}
+
+// Function to apply a partition's buffered updates to the rank sums
+void gatherUpdates(UpdateBuffer *buffer, double sums[]) {
+    for (size_t k = 0; k < buffer->count; k++) {
+        sums[buffer->updates[k].dst] += buffer->updates[k].value;
+    }
+    buffer->count = 0;
+}
+
+int compareRankedVertex(const void *a, const void *b) {
+    const RankedVertex *va = (const RankedVertex *)a;
+    const RankedVertex *vb = (const RankedVertex *)b;
+    double diff = vb->pageRank - va->pageRank;
+    if (diff != 0) {
+        return (diff > 0) - (diff < 0);
+    }
+    return (va->index > vb->index) - (va->index < vb->index);
+}
+
+// Function to calculate PageRank by streaming edges from a binary edge file.
+//
+// Each iteration makes one sequential pass over the edge array. The scatter
+// phase turns every edge into an update for its destination and appends it
+// to the buffer of the destination's vertex partition; a full buffer is
+// gathered into the rank sums of that partition only, so the random writes
+// stay within a cache-sized slice of the rank vector. The file is mapped and
+// walked window by window: the next window is prefetched and the consumed
+// one is dropped, so resident memory is bounded by the rank vectors.
+void calculatePageRankOutOfCore(const char *path, double d, double diffPR,
+                                int maxIterations, int numPartitions, Telemetry *telemetry) {
+    beginPhase(telemetry);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror("Error opening edge file");
+        exit(1);
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        perror("Error reading edge file");
+        exit(1);
+    }
+
+    EdgeFileHeader header;
+    if ((size_t)st.st_size < sizeof(header) ||
+        pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+        memcmp(header.magic, EDGE_FILE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != EDGE_FILE_VERSION) {
+        fprintf(stderr, "Error: %s is not a valid edge file\n", path);
+        exit(1);
+    }
+
+    // Bound every count by the file size before multiplying it out
+    uint64_t N = header.numPages;
+    uint64_t numEdges = header.numEdges;
+    uint64_t fileSize = st.st_size;
+    size_t edgesOffset = sizeof(EdgeFileHeader) + (N <= UINT32_MAX ? N : 0) * sizeof(uint32_t);
+    if (N == 0 || N > UINT32_MAX || edgesOffset > fileSize ||
+        numEdges > (fileSize - edgesOffset) / sizeof(Edge) ||
+        header.urlTableOffset != edgesOffset + numEdges * sizeof(Edge)) {
+        fprintf(stderr, "Error: %s has an inconsistent header\n", path);
+        exit(1);
+    }
+
+    char *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        perror("Error mapping edge file");
+        exit(1);
+    }
+    close(fd);
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    // Only the per-vertex vectors live in RAM
+    uint32_t *outDegree = malloc(N * sizeof(uint32_t));
+    double *prevPR = malloc(N * sizeof(double));
+    double *pageRank = malloc(N * sizeof(double));
+    if (!outDegree || !prevPR || !pageRank) {
+        perror("Error allocating rank vectors");
+        exit(1);
+    }
+    memcpy(outDegree, map + sizeof(EdgeFileHeader), N * sizeof(uint32_t));
+    for (uint64_t i = 0; i < N; i++) {
+        pageRank[i] = 1.0 / N;
+    }
+
+    if (numPartitions <= 0) {
+        numPartitions = (N + PARTITION_VERTICES - 1) / PARTITION_VERTICES;
+    }
+    if ((uint64_t)numPartitions > N) {
+        numPartitions = N;
+    }
+    uint64_t partitionSize = (N + numPartitions - 1) / numPartitions;
+    size_t bufferCapacity = UPDATE_BUFFER_BYTES / numPartitions / sizeof(RankUpdate);
+    if (bufferCapacity == 0) {
+        bufferCapacity = 1;
+    }
+
+    UpdateBuffer *buffers = malloc(numPartitions * sizeof(UpdateBuffer));
+    if (!buffers) {
+        perror("Error allocating update buffers");
+        exit(1);
+    }
+    for (int p = 0; p < numPartitions; p++) {
+        buffers[p].updates = malloc(bufferCapacity * sizeof(RankUpdate));
+        buffers[p].count = 0;
+        if (!buffers[p].updates) {
+            perror("Error allocating update buffers");
+            exit(1);
+        }
+    }
+
+    long pageSize = sysconf(_SC_PAGESIZE);
+    int iteration = 0;
+    double diff;
+
+    endPhase(telemetry, "parse");
+    beginPhase(telemetry);
+    double iterationStart = wallSeconds();
+
+    do {
+        double *tmp = prevPR;
+        prevPR = pageRank;
+        pageRank = tmp;
+        memset(pageRank, 0, N * sizeof(double));
+
+        // Scatter phase: stream the edges window by window
+        size_t offset = edgesOffset;
+        size_t end = header.urlTableOffset;
+        while (offset < end) {
+            size_t windowEnd = offset + EDGE_WINDOW_BYTES;
+            if (windowEnd > end) {
+                windowEnd = end;
+            }
+            if (windowEnd < end) {
+                size_t ahead = windowEnd & ~(size_t)(pageSize - 1);
+                size_t aheadLength = EDGE_WINDOW_BYTES;
+                if (ahead + aheadLength > end) {
+                    aheadLength = end - ahead;
+                }
+                madvise(map + ahead, aheadLength, MADV_WILLNEED);
+            }
+
+            const Edge *edges = (const Edge *)(map + offset);
+            size_t count = (windowEnd - offset) / sizeof(Edge);
+            for (size_t k = 0; k < count; k++) {
+                uint32_t src = edges[k].src;
+                uint32_t dst = edges[k].dst;
+                if (src >= N || dst >= N || outDegree[src] == 0) {
+                    fprintf(stderr, "Error: %s has an invalid edge %u -> %u\n", path, src, dst);
+                    exit(1);
+                }
+                UpdateBuffer *buffer = &buffers[dst / partitionSize];
+                buffer->updates[buffer->count].dst = dst;
+                buffer->updates[buffer->count].value = prevPR[src] / outDegree[src];
+                if (++buffer->count == bufferCapacity) {
+                    gatherUpdates(buffer, pageRank);
+                }
+            }
+
+            // Drop the consumed window from the page cache mapping
+            size_t consumed = (offset + count * sizeof(Edge)) & ~(size_t)(pageSize - 1);
+            size_t start = offset & ~(size_t)(pageSize - 1);
+            if (consumed > start) {
+                madvise(map + start, consumed - start, MADV_DONTNEED);
+            }
+            offset += count * sizeof(Edge);
+        }
+
+        // Gather phase: apply the remaining updates partition by partition
+        for (int p = 0; p < numPartitions; p++) {
+            gatherUpdates(&buffers[p], pageRank);
+        }
+
+        diff = 0.0;
+        double maxDiff = 0.0;
+        for (uint64_t i = 0; i < N; i++) {
+            pageRank[i] = ((1 - d) / N) + (d * pageRank[i]);
+            double change = fabs(pageRank[i] - prevPR[i]);
+            diff += change;
+            if (change > maxDiff) {
+                maxDiff = change;
+            }
+        }
+        iteration++;
+
+        double now = wallSeconds();
+        recordIteration(telemetry, iteration, diff, maxDiff, now - iterationStart);
+        iterationStart = now;
+    } while (iteration < maxIterations && diff >= diffPR);
+
+    double iterateSeconds = endPhase(telemetry, "iterate");
+    if (telemetry) {
+        telemetry->iterations = iteration;
+        telemetry->edges = numEdges;
+        telemetry->iterateSeconds = iterateSeconds;
+    }
+    beginPhase(telemetry);
+
+    // Write the results using the URL table at the end of the file
+    const char **urls = malloc(N * sizeof(char *));
+    RankedVertex *ranked = malloc(N * sizeof(RankedVertex));
+    if (!urls || !ranked) {
+        perror("Error allocating output table");
+        exit(1);
+    }
+    const char *url = map + header.urlTableOffset;
+    const char *tableEnd = map + st.st_size;
+    for (uint64_t i = 0; i < N; i++) {
+        const char *nul = memchr(url, '\0', tableEnd - url);
+        if (!nul) {
+            fprintf(stderr, "Error: %s has a truncated URL table\n", path);
+            exit(1);
+        }
+        urls[i] = url;
+        url = nul + 1;
+        ranked[i].pageRank = pageRank[i];
+        ranked[i].index = i;
+    }
+    qsort(ranked, N, sizeof(RankedVertex), compareRankedVertex);
+    endPhase(telemetry, "sort");
+
+    beginPhase(telemetry);
+    FILE *file = fopen("pagerankList.txt", "w");
+    if (!file) {
+        perror("Error opening pagerankList.txt");
+        exit(1);
+    }
+    for (uint64_t i = 0; i < N; i++) {
+        uint32_t v = ranked[i].index;
+        fprintf(file, "%s, %u, %.7f\n", urls[v], outDegree[v], ranked[i].pageRank);
+    }
+    fclose(file);
+    endPhase(telemetry, "write");
+
+    for (int p = 0; p < numPartitions; p++) {
+        free(buffers[p].updates);
+    }
+    free(buffers);
+    free(urls);
+    free(ranked);
+    free(outDegree);
+    free(prevPR);
+    free(pageRank);
+    munmap(map, st.st_size);
+}
+
+double wallSeconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+double cpuSeconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+void beginPhase(Telemetry *telemetry) {
+    if (telemetry && telemetry->file) {
+        telemetry->phaseWall = wallSeconds();
+        telemetry->phaseCpu = cpuSeconds();
+    }
+}
+
+// Function to record the wall and CPU time of the phase started by the last
+// beginPhase. Returns the wall time of the phase.
+double endPhase(Telemetry *telemetry, const char *phase) {
+    if (!telemetry || !telemetry->file) {
+        return 0.0;
+    }
+    double wall = wallSeconds() - telemetry->phaseWall;
+    double cpu = cpuSeconds() - telemetry->phaseCpu;
+    fprintf(telemetry->file, "{\"event\":\"phase\",\"phase\":\"%s\","
+            "\"wall_s\":%.9f,\"cpu_s\":%.9f}\n", phase, wall, cpu);
+    return wall;
+}
+
+void recordIteration(Telemetry *telemetry, int iteration, double l1, double linf,
+                     double seconds) {
+    if (!telemetry || !telemetry->file) {
+        return;
+    }
+    fprintf(telemetry->file, "{\"event\":\"iteration\",\"iteration\":%d,"
+            "\"l1\":%.9e,\"linf\":%.9e,\"wall_s\":%.9f}\n",
+            iteration, l1, linf, seconds);
+}
+
+// Function to record the totals of the run, including the peak resident
+// set size of the process
+void recordSummary(Telemetry *telemetry) {
+    if (!telemetry || !telemetry->file) {
+        return;
+    }
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    double edgesPerSecond = telemetry->iterateSeconds > 0 ?
+        (double)telemetry->edges * telemetry->iterations / telemetry->iterateSeconds : 0.0;
+    fprintf(telemetry->file, "{\"event\":\"summary\",\"iterations\":%d,"
+            "\"edges\":%ld,\"edges_per_s\":%.1f,\"process_peak_rss_kb\":%ld}\n",
+            telemetry->iterations, telemetry->edges, edgesPerSecond, usage.ru_maxrss);
+}
+
+// Function to send one message over a shard socket
+void sendShardMessage(int fd, int type, double value) {
+    ShardMessage message = { type, value };
+    if (write(fd, &message, sizeof(message)) != (ssize_t)sizeof(message)) {
+        perror("Error sending shard message");
+        exit(1);
+    }
+}
+
+// Function to receive one message over a shard socket. When expectedType is
+// negative any type is accepted and returned through type.
+double receiveShardMessage(int fd, int expectedType, int *type) {
+    ShardMessage message;
+    size_t received = 0;
+    while (received < sizeof(message)) {
+        ssize_t n = read(fd, (char *)&message + received, sizeof(message) - received);
+        if (n <= 0) {
+            fprintf(stderr, "Error: shard connection closed unexpectedly\n");
+            exit(1);
+        }
+        received += n;
+    }
+    if (expectedType >= 0 && message.type != expectedType) {
+        fprintf(stderr, "Error: unexpected shard message %d\n", message.type);
+        exit(1);
+    }
+    if (type) {
+        *type = message.type;
+    }
+    return message.value;
+}
+
+// Function run by each shard worker process. The worker owns pages [lo, hi):
+// it publishes their contributions, then computes their new ranks from the
+// contributions published by every shard.
+void runShardWorker(Page pages[], int N, double d, int lo, int hi, int fd,
+                    double contrib[], double sharedPR[]) {
+    int type;
+    do {
+        for (int j = lo; j < hi; j++) {
+            contrib[j] = pages[j].outDegree != 0 ? sharedPR[j] / pages[j].outDegree : 0.0;
+        }
+        sendShardMessage(fd, SHARD_CONTRIB_READY, 0.0);
+        receiveShardMessage(fd, SHARD_GO, NULL);
+
+        double residual = 0.0;
+        double maxResidual = 0.0;
+        for (int i = lo; i < hi; i++) {
+            double sum = 0.0;
+            for (int j = 0; j < N; j++) {
+                if (pages[j].links[i]) {
+                    sum += contrib[j];
+                }
+            }
+            double pageRank = ((1 - d) / N) + (d * sum);
+            double change = fabs(pageRank - sharedPR[i]);
+            residual += change;
+            if (change > maxResidual) {
+                maxResidual = change;
+            }
+            sharedPR[i] = pageRank;
+        }
+        sendShardMessage(fd, SHARD_RESIDUAL, residual);
+        sendShardMessage(fd, SHARD_MAX_RESIDUAL, maxResidual);
+        receiveShardMessage(fd, -1, &type);
+    } while (type == SHARD_CONTINUE);
+}
+
+// Function to calculate PageRank across several worker processes.
+//
+// The contribution and rank vectors are mapped shared before forking. Each
+// iteration has two synchronisation points driven by the coordinator: once
+// every shard has published its contributions, and once every shard has
+// reported its residual. The coordinator sums the residuals in shard order
+// and tells the workers whether to continue.
+void calculatePageRankSharded(Page pages[], int N, double d, double diffPR,
+                              int maxIterations, int numShards, Telemetry *telemetry) {
+    if (N == 0) {
+        return;
+    }
+    if (numShards > N) {
+        numShards = N;
+    }
+
+    size_t vectorBytes = N * sizeof(double);
+    double *contrib = mmap(NULL, vectorBytes, PROT_READ | PROT_WRITE,
+                           MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    double *sharedPR = mmap(NULL, vectorBytes, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (contrib == MAP_FAILED || sharedPR == MAP_FAILED) {
+        perror("Error mapping shared rank vectors");
+        exit(1);
+    }
+    for (int i = 0; i < N; i++) {
+        sharedPR[i] = pages[i].pageRank;
+    }
+
+    int *fds = malloc(numShards * sizeof(int));
+    pid_t *pids = malloc(numShards * sizeof(pid_t));
+    if (!fds || !pids) {
+        perror("Error allocating shard table");
+        exit(1);
+    }
+
+    fflush(NULL);
+    for (int s = 0; s < numShards; s++) {
+        int pair[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) != 0) {
+            perror("Error creating shard socket");
+            exit(1);
+        }
+        int lo = (long)N * s / numShards;
+        int hi = (long)N * (s + 1) / numShards;
+
+        pids[s] = fork();
+        if (pids[s] < 0) {
+            perror("Error forking shard worker");
+            exit(1);
+        }
+        if (pids[s] == 0) {
+            close(pair[0]);
+            for (int k = 0; k < s; k++) {
+                close(fds[k]);
+            }
+            runShardWorker(pages, N, d, lo, hi, pair[1], contrib, sharedPR);
+            _exit(0);
+        }
+        close(pair[1]);
+        fds[s] = pair[0];
+    }
+
+    int iteration = 0;
+    double diff;
+    double iterationStart = wallSeconds();
+    do {
+        for (int s = 0; s < numShards; s++) {
+            receiveShardMessage(fds[s], SHARD_CONTRIB_READY, NULL);
+        }
+        for (int s = 0; s < numShards; s++) {
+            sendShardMessage(fds[s], SHARD_GO, 0.0);
+        }
+
+        diff = 0.0;
+        double maxDiff = 0.0;
+        for (int s = 0; s < numShards; s++) {
+            diff += receiveShardMessage(fds[s], SHARD_RESIDUAL, NULL);
+            double shardMax = receiveShardMessage(fds[s], SHARD_MAX_RESIDUAL, NULL);
+            if (shardMax > maxDiff) {
+                maxDiff = shardMax;
+            }
+        }
+        iteration++;
+
+        double now = wallSeconds();
+        recordIteration(telemetry, iteration, diff, maxDiff, now - iterationStart);
+        iterationStart = now;
+
+        int type = (iteration < maxIterations && diff >= diffPR) ? SHARD_CONTINUE : SHARD_STOP;
+        for (int s = 0; s < numShards; s++) {
+            sendShardMessage(fds[s], type, 0.0);
+        }
+    } while (iteration < maxIterations && diff >= diffPR);
+
+    for (int s = 0; s < numShards; s++) {
+        int status;
+        if (waitpid(pids[s], &status, 0) < 0 || !WIFEXITED(status) ||
+            WEXITSTATUS(status) != 0) {
+            fprintf(stderr, "Error: shard worker %d failed\n", s);
+            exit(1);
+        }
+        close(fds[s]);
+    }
+
+    for (int i = 0; i < N; i++) {
+        pages[i].pageRank = sharedPR[i];
+    }
+    if (telemetry) {
+        long edges = 0;
+        for (int i = 0; i < N; i++) {
+            for (int j = 0; j < N; j++) {
+                edges += pages[i].links[j] != 0;
+            }
+        }
+        telemetry->iterations = iteration;
+        telemetry->edges = edges;
+    }
+
+    free(fds);
+    free(pids);
+    munmap(contrib, vectorBytes);
+    munmap(sharedPR, vectorBytes);
+}
+
+// Function to compute the block key of a URL under a block rule: "host"
+// keeps the host part of the URL, "prefix:K" its first K characters and
+// "regex:RE" the first subexpression matched by RE, or the whole match if
+// RE has none. A URL the rule does not apply to is its own block. Returns 0
+// for an unknown rule.
+int blockKey(const char *url, const char *rule, const regex_t *regex, char key[]) {
+    size_t length = strlen(url);
+    size_t start = 0;
+
+    if (strcmp(rule, "host") == 0) {
+        const char *scheme = strstr(url, "://");
+        if (scheme) {
+            start = scheme + 3 - url;
+        }
+        const char *slash = strchr(url + start, '/');
+        if (slash) {
+            length = slash - url;
+        }
+    } else if (strncmp(rule, "prefix:", 7) == 0) {
+        size_t prefix = atoi(rule + 7);
+        if (prefix > 0 && prefix < length) {
+            length = prefix;
+        }
+    } else if (strncmp(rule, "regex:", 6) == 0) {
+        regmatch_t match[2];
+        if (regexec(regex, url, 2, match, 0) == 0) {
+            int group = match[1].rm_so >= 0 ? 1 : 0;
+            start = match[group].rm_so;
+            length = match[group].rm_eo;
+        }
+    } else {
+        return 0;
+    }
+
+    memcpy(key, url + start, length - start);
+    key[length - start] = '\0';
+    return 1;
+}
+
+// Function to number the blocks of the pages in order of their keys.
+// Returns the number of blocks.
+int assignBlocks(Page pages[], int N, const char *rule, int blockOf[]) {
+    regex_t regex;
+    if (strncmp(rule, "regex:", 6) == 0 &&
+        regcomp(&regex, rule + 6, REG_EXTENDED) != 0) {
+        fprintf(stderr, "Invalid block regex: %s\n", rule + 6);
+        exit(1);
+    }
+
+    char (*keys)[MAX_URL_LENGTH] = malloc((N > 0 ? N : 1) * sizeof(*keys));
+    int *order = malloc((N > 0 ? N : 1) * sizeof(int));
+    if (!keys || !order) {
+        perror("Error allocating blocks");
+        exit(1);
+    }
+    for (int i = 0; i < N; i++) {
+        if (!blockKey(pages[i].url, rule, &regex, keys[i])) {
+            fprintf(stderr, "Unknown block rule: %s\n", rule);
+            exit(1);
+        }
+        order[i] = i;
+    }
+
+    // Insertion sort of the page indices by key; collections are small
+    for (int k = 1; k < N; k++) {
+        int page = order[k];
+        int m = k;
+        while (m > 0 && strcmp(keys[order[m - 1]], keys[page]) > 0) {
+            order[m] = order[m - 1];
+            m--;
+        }
+        order[m] = page;
+    }
+
+    int numBlocks = 0;
+    for (int k = 0; k < N; k++) {
+        if (k > 0 && strcmp(keys[order[k]], keys[order[k - 1]]) != 0) {
+            numBlocks++;
+        }
+        blockOf[order[k]] = numBlocks;
+    }
+    if (N > 0) {
+        numBlocks++;
+    }
+
+    if (strncmp(rule, "regex:", 6) == 0) {
+        regfree(&regex);
+    }
+    free(keys);
+    free(order);
+    return numBlocks;
+}
+
+// Function run by every thread of the local solves. Claims blocks one at a
+// time and ranks each over the links between its own pages, normalizing
+// the local ranks of a block to sum to 1.
+void *solveLocalRanks(void *arg) {
+    BlockRankJob *job = arg;
+    const Graph *graph = job->graph;
+    const uint32_t *sources = graph->inSources;
+    const double *weights = graph->inWeights;
+    double *rank = job->localRank;
+    double *next = job->scratch;
+
+    for (;;) {
+        pthread_mutex_lock(&job->lock);
+        int b = job->nextBlock++;
+        pthread_mutex_unlock(&job->lock);
+        if (b >= job->numBlocks) {
+            break;
+        }
+
+        const int *members = job->members + job->blockStart[b];
+        int size = job->blockStart[b + 1] - job->blockStart[b];
+        for (int k = 0; k < size; k++) {
+            rank[members[k]] = 1.0 / size;
+        }
+
+        int iteration = 0;
+        double diff = job->diffPR;
+        while (iteration < job->maxIterations && diff >= job->diffPR) {
+            diff = 0.0;
+            for (int k = 0; k < size; k++) {
+                int i = members[k];
+                double sum = 0.0;
+                for (long e = graph->inOffsets[i]; e < graph->inOffsets[i + 1]; e++) {
+                    int j = sources[e];
+                    double weight = weights ? weights[e] : 1.0;
+                    if (job->blockOf[j] == b && weight > 0) {
+                        sum += rank[j] * weight / job->localOut[j];
+                    }
+                }
+                next[i] = ((1 - job->d) / size) + (job->d * sum);
+                diff += fabs(next[i] - rank[i]);
+            }
+            for (int k = 0; k < size; k++) {
+                rank[members[k]] = next[members[k]];
+            }
+            iteration++;
+        }
+
+        double total = 0.0;
+        for (int k = 0; k < size; k++) {
+            total += rank[members[k]];
+        }
+        for (int k = 0; k < size; k++) {
+            rank[members[k]] /= total;
+        }
+
+        pthread_mutex_lock(&job->lock);
+        job->iterations += iteration;
+        pthread_mutex_unlock(&job->lock);
+    }
+    return NULL;
+}
+
+// Function to seed pages[].pageRank with the BlockRank estimate: the local
+// rank of every page inside its block times the rank of its block in the
+// block graph. The block graph links block I to block J with the rank that
+// the pages of I pass to the pages of J, weighted by their local ranks.
+// Local solves run on numThreads threads. With --weighted or --link-weights
+// the links carry the same weights as in the global iteration.
+void seedBlockRank(Page pages[], int N, double d, double diffPR, int maxIterations,
+                   const char *rule, int numThreads, const RankOptions *options) {
+    if (N == 0) {
+        return;
+    }
+    Graph graph;
+    buildGraph(pages, N, &graph);
+    if (options->weighted || options->linkWeights) {
+        weightGraph(pages, &graph, options->linkWeights);
+    }
+    const uint32_t *sources = graph.inSources;
+    const double *weights = graph.inWeights;
+
+    BlockRankJob job;
+    memset(&job, 0, sizeof(job));
+    int *blockOf = malloc(N * sizeof(int));
+    int *blockStart = calloc(N + 1, sizeof(int));
+    int *members = malloc(N * sizeof(int));
+    double *localOut = calloc(N, sizeof(double));
+    double *localRank = malloc(N * sizeof(double));
+    double *scratch = malloc(N * sizeof(double));
+    if (!blockOf || !blockStart || !members || !localOut || !localRank || !scratch) {
+        perror("Error allocating BlockRank vectors");
+        exit(1);
+    }
+    int numBlocks = assignBlocks(pages, N, rule, blockOf);
+
+    for (int i = 0; i < N; i++) {
+        blockStart[blockOf[i] + 1]++;
+        for (long e = graph.inOffsets[i]; e < graph.inOffsets[i + 1]; e++) {
+            if (blockOf[sources[e]] == blockOf[i]) {
+                localOut[sources[e]] += weights ? weights[e] : 1.0;
+            }
+        }
+    }
+    for (int b = 0; b < numBlocks; b++) {
+        blockStart[b + 1] += blockStart[b];
+    }
+    int *fill = calloc(numBlocks, sizeof(int));
+    if (!fill) {
+        perror("Error allocating BlockRank vectors");
+        exit(1);
+    }
+    for (int i = 0; i < N; i++) {
+        members[blockStart[blockOf[i]] + fill[blockOf[i]]++] = i;
+    }
+    free(fill);
+
+    job.graph = &graph;
+    job.blockOf = blockOf;
+    job.blockStart = blockStart;
+    job.members = members;
+    job.localOut = localOut;
+    job.localRank = localRank;
+    job.scratch = scratch;
+    job.numBlocks = numBlocks;
+    job.d = d;
+    job.diffPR = diffPR;
+    job.maxIterations = maxIterations;
+    pthread_mutex_init(&job.lock, NULL);
+
+    if (numThreads < 1) {
+        numThreads = 1;
+    }
+    if (numThreads > numBlocks) {
+        numThreads = numBlocks;
+    }
+    pthread_t *threads = malloc(numThreads * sizeof(pthread_t));
+    if (!threads) {
+        perror("Error allocating BlockRank threads");
+        exit(1);
+    }
+    for (int t = 1; t < numThreads; t++) {
+        if (pthread_create(&threads[t], NULL, solveLocalRanks, &job) != 0) {
+            perror("Error creating BlockRank thread");
+            exit(1);
+        }
+    }
+    solveLocalRanks(&job);
+    for (int t = 1; t < numThreads; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    free(threads);
+    pthread_mutex_destroy(&job.lock);
+
+    // Block graph, with the rank page j passes over each link as in the
+    // global iteration
+    double *blockLinks = calloc((size_t)numBlocks * numBlocks, sizeof(double));
+    double *blockRank = malloc(numBlocks * sizeof(double));
+    double *nextBlockRank = malloc(numBlocks * sizeof(double));
+    if (!blockLinks || !blockRank || !nextBlockRank) {
+        perror("Error allocating block graph");
+        exit(1);
+    }
+    for (int i = 0; i < N; i++) {
+        for (long e = graph.inOffsets[i]; e < graph.inOffsets[i + 1]; e++) {
+            int j = sources[e];
+            double share = weights ? (weights[e] > 0 ? weights[e] / graph.outWeight[j] : 0.0)
+                                   : 1.0 / pages[j].outDegree;
+            blockLinks[(size_t)blockOf[j] * numBlocks + blockOf[i]] += localRank[j] * share;
+        }
+    }
+
+    for (int b = 0; b < numBlocks; b++) {
+        blockRank[b] = 1.0 / numBlocks;
+    }
+    int blockIterations = 0;
+    double diff = diffPR;
+    while (blockIterations < maxIterations && diff >= diffPR) {
+        diff = 0.0;
+        for (int to = 0; to < numBlocks; to++) {
+            double sum = 0.0;
+            for (int from = 0; from < numBlocks; from++) {
+                sum += blockRank[from] * blockLinks[(size_t)from * numBlocks + to];
+            }
+            nextBlockRank[to] = ((1 - d) / numBlocks) + (d * sum);
+            diff += fabs(nextBlockRank[to] - blockRank[to]);
+        }
+        memcpy(blockRank, nextBlockRank, numBlocks * sizeof(double));
+        blockIterations++;
+    }
+
+    for (int i = 0; i < N; i++) {
+        pages[i].pageRank = localRank[i] * blockRank[blockOf[i]];
+    }
+    fprintf(stderr, "blockrank: %d blocks, %ld local iterations, %d block iterations\n",
+            numBlocks, job.iterations, blockIterations);
+
+    free(blockLinks);
+    free(blockRank);
+    free(nextBlockRank);
+    free(blockOf);
+    free(blockStart);
+    free(members);
+    free(localOut);
+    free(localRank);
+    free(scratch);
+    freeGraph(&graph);
+}
+
+// benchPagerank.c includes this file with PAGERANK_NO_MAIN defined to
+// benchmark the functions above
+#ifndef PAGERANK_NO_MAIN
+int main(int argc, char **argv) {
+    if (argc < 4) {
+        fprintf(stderr, "Usage: %s d diffPR maxIterations "
+                "[--edge-file FILE] [--write-edges FILE] [--partitions P] "
+                "[--shards N] [--threads N] [--numa] "
+                "[--hugepages off|transparent|explicit] [--compress] "
+                "[--telemetry FILE|-] [--checkpoint FILE] [--checkpoint-every K] "
+                "[--resume] [--perf-counters] [--rank-type double|float] "
+                "[--dangling drop|uniform] [--index-width 32|64] [--weighted] "
+                "[--link-weights FILE] [--block-rank host|prefix:K|regex:RE] "
+                "[--top-k K] [--push auto|atomic|buffered] [--frontier] "
+                "[--schedule static|steal] [--deterministic]\n", argv[0]);
+        return 1;
+    }
+
+    double d = atof(argv[1]);
+    double diffPR = atof(argv[2]);
+    int maxIterations = atoi(argv[3]);
+
+    const char *edgeFile = NULL;
+    const char *writeEdges = NULL;
+    int numPartitions = 0;
+    int numShards = 0;
+    const char *blockRule = NULL;
+    Telemetry telemetry;
+    memset(&telemetry, 0, sizeof(telemetry));
+    RankOptions options = { 1, 0, HUGE_PAGES_OFF, 0, &telemetry, 0, NULL, NULL, 10, 0, 0,
+                            RANK_DOUBLE, DANGLING_DROP, 0, 0, PUSH_OFF, 0,
+                            SCHEDULE_DEFAULT, 0 };
+    for (int i = 4; i < argc; i++) {
+        if (strcmp(argv[i], "--edge-file") == 0 && i + 1 < argc) {
+            edgeFile = argv[++i];
+        } else if (strcmp(argv[i], "--write-edges") == 0 && i + 1 < argc) {
+            writeEdges = argv[++i];
+        } else if (strcmp(argv[i], "--partitions") == 0 && i + 1 < argc) {
+            numPartitions = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--shards") == 0 && i + 1 < argc) {
+            numShards = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            options.numThreads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--numa") == 0) {
+            options.numa = 1;
+        } else if (strcmp(argv[i], "--telemetry") == 0 && i + 1 < argc) {
+            i++;
+            telemetry.file = strcmp(argv[i], "-") == 0 ? stderr : fopen(argv[i], "w");
+            if (!telemetry.file) {
+                perror("Error opening telemetry file");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--checkpoint") == 0 && i + 1 < argc) {
+            options.checkpointPath = argv[++i];
+        } else if (strcmp(argv[i], "--checkpoint-every") == 0 && i + 1 < argc) {
+            options.checkpointEvery = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--resume") == 0) {
+            options.resume = 1;
+        } else if (strcmp(argv[i], "--perf-counters") == 0) {
+            options.perfCounters = 1;
+        } else if (strcmp(argv[i], "--compress") == 0) {
+            options.compress = 1;
+        } else if (strcmp(argv[i], "--push") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "auto") == 0) {
+                options.push = PUSH_AUTO;
+            } else if (strcmp(argv[i], "atomic") == 0) {
+                options.push = PUSH_ATOMIC;
+            } else if (strcmp(argv[i], "buffered") == 0) {
+                options.push = PUSH_BUFFERED;
+            } else {
+                fprintf(stderr, "Unknown push mode: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--schedule") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "static") == 0) {
+                options.schedule = SCHEDULE_STATIC;
+            } else if (strcmp(argv[i], "steal") == 0) {
+                options.schedule = SCHEDULE_STEAL;
+            } else {
+                fprintf(stderr, "Unknown schedule: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--deterministic") == 0) {
+            options.deterministic = 1;
+        } else if (strcmp(argv[i], "--frontier") == 0) {
+            options.frontier = 1;
+        } else if (strcmp(argv[i], "--top-k") == 0 && i + 1 < argc) {
+            options.topK = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--block-rank") == 0 && i + 1 < argc) {
+            blockRule = argv[++i];
+        } else if (strcmp(argv[i], "--weighted") == 0) {
+            options.weighted = 1;
+        } else if (strcmp(argv[i], "--link-weights") == 0 && i + 1 < argc) {
+            options.linkWeights = argv[++i];
+        } else if (strcmp(argv[i], "--rank-type") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "double") == 0) {
+                options.rankType = RANK_DOUBLE;
+            } else if (strcmp(argv[i], "float") == 0) {
+                options.rankType = RANK_FLOAT;
+            } else {
+                fprintf(stderr, "Unknown rank type: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--dangling") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "drop") == 0) {
+                options.dangling = DANGLING_DROP;
+            } else if (strcmp(argv[i], "uniform") == 0) {
+                options.dangling = DANGLING_UNIFORM;
+            } else {
+                fprintf(stderr, "Unknown dangling policy: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--index-width") == 0 && i + 1 < argc) {
+            options.indexWidth = atoi(argv[++i]);
+            if (options.indexWidth != 32 && options.indexWidth != 64) {
+                fprintf(stderr, "Index width must be 32 or 64\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--hugepages") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "off") == 0) {
+                options.hugePages = HUGE_PAGES_OFF;
+            } else if (strcmp(argv[i], "transparent") == 0) {
+                options.hugePages = HUGE_PAGES_TRANSPARENT;
+            } else if (strcmp(argv[i], "explicit") == 0) {
+                options.hugePages = HUGE_PAGES_EXPLICIT;
+            } else {
+                fprintf(stderr, "Unknown huge page mode: %s\n", argv[i]);
+                return 1;
+            }
+        } else {
+            fprintf(stderr, "Unknown option: %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    if (options.resume && !options.checkpointPath) {
+        fprintf(stderr, "--resume needs --checkpoint FILE\n");
+        return 1;
+    }
+    if (options.deterministic && (options.push != PUSH_OFF || options.frontier ||
+                                  numShards > 0 || edgeFile)) {
+        fprintf(stderr, "--deterministic needs the in-memory pull iteration\n");
+        return 1;
+    }
+    if (options.checkpointPath && (numShards > 0 || edgeFile)) {
+        fprintf(stderr, "--checkpoint needs the in-memory iteration\n");
+        return 1;
+    }
+    if ((options.weighted || options.linkWeights) && (numShards > 0 || edgeFile)) {
+        fprintf(stderr, "--weighted and --link-weights need the in-memory iteration\n");
+        return 1;
+    }
+    // The push iteration takes --threads and nothing else of the pull one
+    if (options.push != PUSH_OFF || options.frontier) {
+        const char *unsupported = NULL;
+        if (numShards > 0) {
+            unsupported = "--shards";
+        } else if (edgeFile) {
+            unsupported = "--edge-file";
+        } else if (options.weighted) {
+            unsupported = "--weighted";
+        } else if (options.linkWeights) {
+            unsupported = "--link-weights";
+        } else if (options.topK > 0) {
+            unsupported = "--top-k";
+        } else if (options.rankType != RANK_DOUBLE) {
+            unsupported = "--rank-type float";
+        } else if (options.dangling != DANGLING_DROP) {
+            unsupported = "--dangling uniform";
+        } else if (options.checkpointPath) {
+            unsupported = "--checkpoint";
+        } else if (options.compress) {
+            unsupported = "--compress";
+        } else if (options.hugePages != HUGE_PAGES_OFF) {
+            unsupported = "--hugepages";
+        } else if (options.numa) {
+            unsupported = "--numa";
+        } else if (options.perfCounters) {
+            unsupported = "--perf-counters";
+        } else if (options.schedule != SCHEDULE_DEFAULT) {
+            unsupported = "--schedule";
+        } else if (options.indexWidth != 0) {
+            unsupported = "--index-width";
+        }
+        if (unsupported) {
+            fprintf(stderr, "--push and --frontier do not support %s\n", unsupported);
+            return 1;
+        }
+    }
+    // The sharded and out-of-core drivers run the plain double iteration
+    if (numShards > 0 || edgeFile) {
+        const char *unsupported = NULL;
+        if (options.compress) {
+            unsupported = "--compress";
+        } else if (options.dangling != DANGLING_DROP) {
+            unsupported = "--dangling uniform";
+        } else if (options.rankType != RANK_DOUBLE) {
+            unsupported = "--rank-type float";
+        } else if (options.indexWidth != 0) {
+            unsupported = "--index-width";
+        } else if (options.topK > 0) {
+            unsupported = "--top-k";
+        } else if (options.numThreads != 1) {
+            unsupported = "--threads";
+        } else if (options.hugePages != HUGE_PAGES_OFF) {
+            unsupported = "--hugepages";
+        } else if (options.numa) {
+            unsupported = "--numa";
+        } else if (options.perfCounters) {
+            unsupported = "--perf-counters";
+        } else if (options.schedule != SCHEDULE_DEFAULT) {
+            unsupported = "--schedule";
+        }
+        if (unsupported) {
+            fprintf(stderr, "--shards and --edge-file do not support %s\n", unsupported);
+            return 1;
+        }
+    }
+    if (blockRule && edgeFile) {
+        fprintf(stderr, "--block-rank needs the collection, not --edge-file\n");
+        return 1;
+    }
+    // The certificate bounds the distance to the fixed point of the exact
+    // iteration; float contributions round away from it every iteration
+    if (options.topK > 0 && options.rankType == RANK_FLOAT) {
+        fprintf(stderr, "--top-k needs --rank-type double\n");
+        return 1;
+    }
+    if (options.compress && (options.weighted || options.linkWeights)) {
+        fprintf(stderr, "--compress does not support weighted links\n");
+        return 1;
+    }
+
+    if (edgeFile) {
+        calculatePageRankOutOfCore(edgeFile, d, diffPR, maxIterations, numPartitions,
+                                   &telemetry);
+    } else {
+        Page pages[MAX_URLS];
+        beginPhase(&telemetry);
+        int N = readCollection(pages, MAX_URLS);
+        if (writeEdges) {
+            writeEdgeFile(pages, N, writeEdges);
+        }
+        endPhase(&telemetry, "parse");
+
+        if (blockRule) {
+            beginPhase(&telemetry);
+            seedBlockRank(pages, N, d, diffPR, maxIterations, blockRule, options.numThreads,
+                          &options);
+            endPhase(&telemetry, "blockrank");
+        }
+
+        if (numShards > 0) {
+            beginPhase(&telemetry);
+            calculatePageRankSharded(pages, N, d, diffPR, maxIterations, numShards,
+                                     &telemetry);
+            telemetry.iterateSeconds = endPhase(&telemetry, "iterate");
+        } else if (options.push != PUSH_OFF || options.frontier) {
+            if (options.push == PUSH_OFF) {
+                options.push = PUSH_AUTO;
+            }
+            calculatePageRankPush(pages, N, d, diffPR, maxIterations, &options);
+        } else {
+            calculatePageRank(pages, N, d, diffPR, maxIterations, &options);
+        }
+        writePageRankToFile(pages, N, &telemetry);
+    }
+
+    recordSummary(&telemetry);
+    if (telemetry.file && telemetry.file != stderr) {
+        fclose(telemetry.file);
+    }
     return 0;
 }
+#endif
@@ -12,9 +12,21 @@
 // The final output is a ranked list of URLs, ordered by relevance 
 // (matching terms first) and PageRank score second.
 //
+// With `--binary` the terms are looked up in `invertedIndex.bin` instead,
+// which is memory-mapped and checked rather than parsed. If that index was
+// built with `--positions`, a quoted argument such as "page rank" matches
+// the words as a phrase, and `word1 NEAR/k word2` matches the two words at
+// most k positions apart. Each such query counts as one matching term, and
+// URLs with as many matching terms are ranked by how often the terms occur.
+//
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "indexFile.h"
 
 #define MAX_WORD_LENGTH 1000
 #define MAX_URLS 1000
@@ -23,6 +35,7 @@
 typedef struct {
     char url[MAX_WORD_LENGTH];
     int matchCount;
+    int termFrequency;      // occurrences of the matching terms, if indexed
     double pageRank;
 } URL;
 
@@ -37,27 +50,63 @@ typedef struct {
     int urlCount;
 } PageRankList;
 
+// Memory-mapped binary index, see indexFile.h
+typedef struct {
+    const unsigned char *data;
+    size_t size;
+    const IndexFileHeader *header;
+    const uint32_t *docOffsets;
+    const char *names;
+    const unsigned char *postings;
+    const IndexTerm *terms;
+    const char *words;
+} IndexFile;
+
+// Position in the posting list of one term of the binary index
+typedef struct {
+    IndexFile *index;
+    const unsigned char *p;
+    uint32_t remaining;     // documents not yet decoded
+    uint32_t docId;
+    uint32_t frequency;     // 0 unless the index has positions
+    uint32_t *positions;    // positions of the term in the current document
+    uint32_t positionCapacity;
+} PostingCursor;
+
 // Function prototypes
 void parseInvertedIndex(const char *filename, WordEntry **wordEntries, int *wordCount);
+void openIndexFile(const char *filename, IndexFile *index);
+const IndexTerm *findIndexTerm(IndexFile *index, const char *word);
+void closeIndexFile(IndexFile *index);
+uint64_t decodeVarint(IndexFile *index, const unsigned char **p);
+void openCursor(IndexFile *index, const IndexTerm *term, PostingCursor *cursor);
+int nextPosting(PostingCursor *cursor);
+int containsPosition(const PostingCursor *cursor, uint32_t position);
+int countOccurrences(PostingCursor *cursors, int numWords, int near, int sameTerm);
+void matchPositional(IndexFile *index, PageRankList *pageRankList, char **words, int numWords,
+                     int near);
+int nearDistance(const char *operator);
+int isPositionalQuery(char **searchTerms, int termCount);
 void parsePageRankList(const char *filename, PageRankList *pageRankList);
+void addMatch(PageRankList *pageRankList, const char *url, int frequency);
+void collectMatches(PageRankList *pageRankList, URL *results, int *resultCount);
 void findMatchingURLs(WordEntry *wordEntries, int wordCount, PageRankList *pageRankList, char **searchTerms, int termCount, URL *results, int *resultCount);
+void findMatchingURLsInIndexFile(IndexFile *index, PageRankList *pageRankList,
+                                 char **searchTerms, int termCount, URL *results,
+                                 int *resultCount);
 void rankAndPrintResults(URL *results, int resultCount);
 void freeWordEntries(WordEntry *wordEntries, int wordCount);
 
 // Main function
 int main(int argc, char **argv) {
-    if (argc < 2) {
-        fprintf(stderr, "Usage: %s <search terms>\n", argv[0]);
+    int binary = argc > 1 && strcmp(argv[1], "--binary") == 0;
+    if (argc < 2 + binary) {
+        fprintf(stderr, "Usage: %s [--binary] <search terms>\n", argv[0]);
         return 1;
     }
 
-    char **searchTerms = argv + 1;
-    int termCount = argc - 1;
-
-    // Parse invertedIndex.txt
-    WordEntry *wordEntries = NULL;
-    int wordCount = 0;
-    parseInvertedIndex("invertedIndex.txt", &wordEntries, &wordCount);
+    char **searchTerms = argv + 1 + binary;
+    int termCount = argc - 1 - binary;
 
     // Parse pagerankList.txt
     PageRankList pageRankList;
@@ -66,14 +115,31 @@ int main(int argc, char **argv) {
     // Find matching URLs
     URL results[MAX_URLS];
     int resultCount = 0;
-    findMatchingURLs(wordEntries, wordCount, &pageRankList, searchTerms, termCount, results, &resultCount);
+    if (binary) {
+        IndexFile index;
+        openIndexFile("invertedIndex.bin", &index);
+        findMatchingURLsInIndexFile(&index, &pageRankList, searchTerms, termCount,
+                                    results, &resultCount);
+        closeIndexFile(&index);
+    } else {
+        if (isPositionalQuery(searchTerms, termCount)) {
+            fprintf(stderr, "Phrase and NEAR queries need --binary and an index built "
+                    "with --positions\n");
+            return 1;
+        }
+
+        // Parse invertedIndex.txt
+        WordEntry *wordEntries = NULL;
+        int wordCount = 0;
+        parseInvertedIndex("invertedIndex.txt", &wordEntries, &wordCount);
+        findMatchingURLs(wordEntries, wordCount, &pageRankList, searchTerms, termCount,
+                         results, &resultCount);
+        freeWordEntries(wordEntries, wordCount);
+    }
 
     // Rank and print results
     rankAndPrintResults(results, resultCount);
 
-    // Cleanup
-    freeWordEntries(wordEntries, wordCount);
-
     return 0;
 }
 
@@ -105,6 +171,320 @@ void parseInvertedIndex(const char *filename, WordEntry **wordEntries, int *word
     fclose(file);
 }
 
+// Function to map invertedIndex.bin and check its header, layout and
+// checksums
+void openIndexFile(const char *filename, IndexFile *index) {
+    int fd = open(filename, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        perror("Error opening invertedIndex.bin");
+        exit(1);
+    }
+    index->size = st.st_size;
+    if (index->size < sizeof(IndexFileHeader)) {
+        fprintf(stderr, "Invalid invertedIndex.bin: too short\n");
+        exit(1);
+    }
+    void *data = mmap(NULL, index->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        perror("Error mapping invertedIndex.bin");
+        exit(1);
+    }
+    index->data = data;
+
+    const IndexFileHeader *header = data;
+    index->header = header;
+    if (memcmp(header->magic, INDEX_FILE_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != INDEX_FILE_VERSION) {
+        fprintf(stderr, "Invalid invertedIndex.bin: unknown format or version\n");
+        exit(1);
+    }
+    if (header->headerChecksum !=
+        indexChecksum(0, header, offsetof(IndexFileHeader, headerChecksum))) {
+        fprintf(stderr, "Invalid invertedIndex.bin: header checksum mismatch\n");
+        exit(1);
+    }
+    uint64_t docTableEnd = sizeof(IndexFileHeader) + ((uint64_t)header->numDocs + 1) * sizeof(uint32_t);
+    // Bound the offsets by the file size first, then compare by subtraction
+    // so that no sum can wrap around
+    if (header->fileSize != index->size || header->wordsOffset > index->size ||
+        header->termsOffset > header->wordsOffset ||
+        header->postingsOffset > header->termsOffset ||
+        header->namesOffset > header->postingsOffset || docTableEnd > header->namesOffset ||
+        header->termsOffset % 8 != 0 ||
+        header->numTerms > (header->wordsOffset - header->termsOffset) / sizeof(IndexTerm)) {
+        fprintf(stderr, "Invalid invertedIndex.bin: bad section offsets\n");
+        exit(1);
+    }
+    if (header->bodyChecksum != indexChecksum(0, index->data + sizeof(IndexFileHeader),
+                                              index->size - sizeof(IndexFileHeader))) {
+        fprintf(stderr, "Invalid invertedIndex.bin: body checksum mismatch\n");
+        exit(1);
+    }
+
+    index->docOffsets = (const uint32_t *)(index->data + sizeof(IndexFileHeader));
+    index->names = (const char *)index->data + header->namesOffset;
+    index->postings = index->data + header->postingsOffset;
+    index->terms = (const IndexTerm *)(index->data + header->termsOffset);
+    index->words = (const char *)index->data + header->wordsOffset;
+
+    // Every name and word must end inside its section
+    uint64_t namesSize = header->postingsOffset - header->namesOffset;
+    uint64_t wordsSize = index->size - header->wordsOffset;
+    if (index->docOffsets[header->numDocs] > namesSize ||
+        (header->numDocs > 0 && index->names[index->docOffsets[header->numDocs] - 1] != '\0') ||
+        (header->numTerms > 0 && (wordsSize == 0 || index->words[wordsSize - 1] != '\0'))) {
+        fprintf(stderr, "Invalid invertedIndex.bin: unterminated strings\n");
+        exit(1);
+    }
+    for (uint32_t doc = 0; doc < header->numDocs; doc++) {
+        if (index->docOffsets[doc] > index->docOffsets[doc + 1]) {
+            fprintf(stderr, "Invalid invertedIndex.bin: bad document table\n");
+            exit(1);
+        }
+    }
+    for (uint32_t t = 0; t < header->numTerms; t++) {
+        if (index->terms[t].wordOffset >= wordsSize ||
+            index->terms[t].postingsOffset > header->termsOffset - header->postingsOffset) {
+            fprintf(stderr, "Invalid invertedIndex.bin: bad term dictionary\n");
+            exit(1);
+        }
+    }
+}
+
+// Function to binary search the term dictionary of the binary index
+const IndexTerm *findIndexTerm(IndexFile *index, const char *word) {
+    uint32_t lo = 0, hi = index->header->numTerms;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        int order = strcmp(index->words + index->terms[mid].wordOffset, word);
+        if (order == 0) {
+            return &index->terms[mid];
+        }
+        if (order < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return NULL;
+}
+
+// Function to unmap the binary index
+void closeIndexFile(IndexFile *index) {
+    munmap((void *)index->data, index->size);
+}
+
+// Function to read a LEB128 varint from the postings of the binary index
+uint64_t decodeVarint(IndexFile *index, const unsigned char **p) {
+    const unsigned char *end = index->data + index->header->termsOffset;
+    uint64_t value = 0;
+    int shift = 0;
+    do {
+        if (*p == end || shift > 35) {
+            fprintf(stderr, "Invalid invertedIndex.bin: bad postings\n");
+            exit(1);
+        }
+        value |= (uint64_t)(**p & 0x7F) << shift;
+        shift += 7;
+    } while (*(*p)++ & 0x80);
+    return value;
+}
+
+// Function to start reading the posting list of a term; a missing term
+// (NULL) has an empty list
+void openCursor(IndexFile *index, const IndexTerm *term, PostingCursor *cursor) {
+    cursor->index = index;
+    cursor->p = index->postings + (term ? term->postingsOffset : 0);
+    cursor->remaining = term ? term->docCount : 0;
+    cursor->docId = 0;
+    cursor->frequency = 0;
+    cursor->positions = NULL;
+    cursor->positionCapacity = 0;
+}
+
+// Function to decode the next document of a posting list, returning 0 after
+// the last one
+int nextPosting(PostingCursor *cursor) {
+    IndexFile *index = cursor->index;
+    if (cursor->remaining == 0) {
+        return 0;
+    }
+    cursor->remaining--;
+
+    uint64_t gap = decodeVarint(index, &cursor->p);
+    if (!(index->header->flags & INDEX_FILE_POSITIONS)) {
+        cursor->docId += gap;
+    } else {
+        cursor->docId += gap >> 1;
+        uint64_t frequency = gap & 1 ? 1 : decodeVarint(index, &cursor->p);
+        if (frequency == 0 || frequency > UINT32_MAX) {
+            fprintf(stderr, "Invalid invertedIndex.bin: bad postings\n");
+            exit(1);
+        }
+        cursor->frequency = frequency;
+        if (cursor->frequency > cursor->positionCapacity) {
+            cursor->positionCapacity = cursor->frequency;
+            cursor->positions = realloc(cursor->positions,
+                                        cursor->positionCapacity * sizeof(uint32_t));
+            if (!cursor->positions) {
+                perror("Error allocating memory for positions");
+                exit(1);
+            }
+        }
+        uint64_t position = 0;
+        for (uint32_t k = 0; k < cursor->frequency; k++) {
+            uint64_t positionGap = decodeVarint(index, &cursor->p);
+            position += positionGap;
+            if ((k > 0 && positionGap == 0) || position > UINT32_MAX) {
+                fprintf(stderr, "Invalid invertedIndex.bin: bad positions\n");
+                exit(1);
+            }
+            cursor->positions[k] = position;
+        }
+    }
+    if (cursor->docId >= index->header->numDocs) {
+        fprintf(stderr, "Invalid invertedIndex.bin: bad postings\n");
+        exit(1);
+    }
+    return 1;
+}
+
+// Function to binary search the positions of the current document
+int containsPosition(const PostingCursor *cursor, uint32_t position) {
+    uint32_t lo = 0, hi = cursor->frequency;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (cursor->positions[mid] == position) {
+            return 1;
+        }
+        if (cursor->positions[mid] < position) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return 0;
+}
+
+// Function to count how often the words occur as a phrase in the document
+// every cursor is on, or with near >= 0, how many positions of the first
+// word have the second word at most near positions away. When both words
+// are the same term, a position does not count as near itself. Positions
+// are compared in 64 bits so that adding near or the phrase offset cannot
+// wrap around.
+int countOccurrences(PostingCursor *cursors, int numWords, int near, int sameTerm) {
+    int count = 0;
+    if (near >= 0) {
+        PostingCursor *other = &cursors[1];
+        uint32_t j = 0;
+        for (uint32_t k = 0; k < cursors[0].frequency; k++) {
+            uint32_t position = cursors[0].positions[k];
+            while (j < other->frequency &&
+                   (uint64_t)other->positions[j] + (uint64_t)near < position) {
+                j++;
+            }
+            uint32_t m = j;
+            if (sameTerm && m < other->frequency && other->positions[m] == position) {
+                m++;
+            }
+            if (m < other->frequency &&
+                other->positions[m] <= (uint64_t)position + (uint64_t)near) {
+                count++;
+            }
+        }
+        return count;
+    }
+
+    for (uint32_t k = 0; k < cursors[0].frequency; k++) {
+        uint32_t position = cursors[0].positions[k];
+        int i = 1;
+        while (i < numWords && (uint64_t)position + i <= UINT32_MAX &&
+               containsPosition(&cursors[i], position + i)) {
+            i++;
+        }
+        if (i == numWords) {
+            count++;
+        }
+    }
+    return count;
+}
+
+// Function to match a phrase (near < 0) or two words at most near positions
+// apart by intersecting their posting lists one document at a time
+void matchPositional(IndexFile *index, PageRankList *pageRankList, char **words, int numWords,
+                     int near) {
+    PostingCursor *cursors = malloc(numWords * sizeof(PostingCursor));
+    if (!cursors) {
+        perror("Error allocating memory for query");
+        exit(1);
+    }
+    int valid = 1;
+    const IndexTerm *first = NULL;
+    int sameTerm = 0;
+    for (int i = 0; i < numWords; i++) {
+        const IndexTerm *term = findIndexTerm(index, words[i]);
+        if (i == 0) {
+            first = term;
+        } else {
+            sameTerm = term == first;
+        }
+        openCursor(index, term, &cursors[i]);
+        valid = nextPosting(&cursors[i]) && valid;
+    }
+
+    while (valid) {
+        // Move every cursor up to the furthest document
+        uint32_t target = 0;
+        for (int i = 0; i < numWords; i++) {
+            if (cursors[i].docId > target) {
+                target = cursors[i].docId;
+            }
+        }
+        int aligned = 1;
+        for (int i = 0; i < numWords && valid; i++) {
+            while (cursors[i].docId < target && (valid = nextPosting(&cursors[i]))) {
+            }
+            aligned = aligned && cursors[i].docId == target;
+        }
+        if (!valid || !aligned) {
+            continue;
+        }
+
+        int count = countOccurrences(cursors, numWords, near, near >= 0 && sameTerm);
+        if (count > 0) {
+            addMatch(pageRankList, index->names + index->docOffsets[target], count);
+        }
+        valid = nextPosting(&cursors[0]);
+    }
+
+    for (int i = 0; i < numWords; i++) {
+        free(cursors[i].positions);
+    }
+    free(cursors);
+}
+
+// Function to read the distance of a NEAR/k operator, or -1 if it is not one
+int nearDistance(const char *operator) {
+    int distance;
+    char extra;
+    if (sscanf(operator, "NEAR/%d%c", &distance, &extra) == 1 && distance >= 0) {
+        return distance;
+    }
+    return -1;
+}
+
+// Function to check whether a query has phrases or NEAR operators
+int isPositionalQuery(char **searchTerms, int termCount) {
+    for (int i = 0; i < termCount; i++) {
+        if (strchr(searchTerms[i], ' ') || nearDistance(searchTerms[i]) >= 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
 // Function to parse pagerankList.txt
 void parsePageRankList(const char *filename, PageRankList *pageRankList) {
     FILE *file = fopen(filename, "r");
@@ -118,6 +498,7 @@ void parsePageRankList(const char *filename, PageRankList *pageRankList) {
         URL *url = &pageRankList->urls[pageRankList->urlCount];
         if (fscanf(file, "%[^,], %*d, %lf\n", url->url, &url->pageRank) == 2) {
             url->matchCount = 0;
+            url->termFrequency = 0;
             pageRankList->urlCount++;
         }
     }
@@ -136,17 +517,90 @@ void findMatchingURLs(
         for (int j = 0; j < wordCount; j++) {
             if (strcmp(searchTerms[i], wordEntries[j].word) == 0) {
                 for (int k = 0; k < wordEntries[j].urlCount; k++) {
-                    for (int l = 0; l < pageRankList->urlCount; l++) {
-                        if (strcmp(wordEntries[j].urls[k], 
-                                  pageRankList->urls[l].url) == 0) {
-                            pageRankList->urls[l].matchCount++;
-                        }
-                    }
+                    addMatch(pageRankList, wordEntries[j].urls[k], 0);
                 }
             }
         }
     }
 
+    collectMatches(pageRankList, results, resultCount);
+}
+
+// Function to find matching URLs in the binary index, decoding only the
+// posting lists of the search terms
+void findMatchingURLsInIndexFile(IndexFile *index, PageRankList *pageRankList,
+                                 char **searchTerms, int termCount, URL *results,
+                                 int *resultCount) {
+    *resultCount = 0;
+    if (isPositionalQuery(searchTerms, termCount) &&
+        !(index->header->flags & INDEX_FILE_POSITIONS)) {
+        fprintf(stderr, "Phrase and NEAR queries need an index built with --positions\n");
+        exit(1);
+    }
+
+    for (int i = 0; i < termCount; i++) {
+        // NEAR/k joins the two terms around it and nothing else
+        int near = i + 2 < termCount ? nearDistance(searchTerms[i + 1]) : -1;
+        if (nearDistance(searchTerms[i]) >= 0 ||
+            (near >= 0 && nearDistance(searchTerms[i + 2]) >= 0)) {
+            fprintf(stderr, "Usage: NEAR/k needs a term on each side, e.g. web NEAR/5 graph\n");
+            exit(1);
+        }
+        if (near >= 0) {
+            char *pair[2] = { searchTerms[i], searchTerms[i + 2] };
+            matchPositional(index, pageRankList, pair, 2, near);
+            i += 2;
+            continue;
+        }
+
+        if (strchr(searchTerms[i], ' ')) {
+            char *phrase = strdup(searchTerms[i]);
+            char **words = malloc((strlen(phrase) / 2 + 1) * sizeof(char *));
+            if (!phrase || !words) {
+                perror("Error allocating memory for phrase");
+                exit(1);
+            }
+            int numWords = 0;
+            for (char *word = strtok(phrase, " "); word; word = strtok(NULL, " ")) {
+                words[numWords++] = word;
+            }
+            if (numWords > 0) {
+                matchPositional(index, pageRankList, words, numWords, -1);
+            }
+            free(words);
+            free(phrase);
+            continue;
+        }
+
+        const IndexTerm *term = findIndexTerm(index, searchTerms[i]);
+        if (!term) {
+            continue;
+        }
+        PostingCursor cursor;
+        openCursor(index, term, &cursor);
+        while (nextPosting(&cursor)) {
+            addMatch(pageRankList, index->names + index->docOffsets[cursor.docId],
+                     cursor.frequency);
+        }
+        free(cursor.positions);
+    }
+
+    collectMatches(pageRankList, results, resultCount);
+}
+
+// Function to count a match, with how often the term occurs in the URL, for
+// every PageRank entry of the URL
+void addMatch(PageRankList *pageRankList, const char *url, int frequency) {
+    for (int l = 0; l < pageRankList->urlCount; l++) {
+        if (strcmp(url, pageRankList->urls[l].url) == 0) {
+            pageRankList->urls[l].matchCount++;
+            pageRankList->urls[l].termFrequency += frequency;
+        }
+    }
+}
+
+// Function to collect the URLs with at least one match
+void collectMatches(PageRankList *pageRankList, URL *results, int *resultCount) {
     for (int i = 0; i < pageRankList->urlCount; i++) {
         if (pageRankList->urls[i].matchCount > 0) {
             results[(*resultCount)++] = pageRankList->urls[i];
@@ -162,6 +616,9 @@ int compareURLs(const void *a, const void *b) {
     if (urlA->matchCount != urlB->matchCount) {
         return urlB->matchCount - urlA->matchCount;
     }
+    if (urlA->termFrequency != urlB->termFrequency) {
+        return urlB->termFrequency - urlA->termFrequency;
+    }
     if (urlA->pageRank != urlB->pageRank) {
         return (urlB->pageRank > urlA->pageRank) - (urlB->pageRank < urlA->pageRank);
     }